@@ -0,0 +1,191 @@
+#ifndef ADDRESS_DETECTOR_HH
+#define ADDRESS_DETECTOR_HH
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The size of an inet6 address before sin6_scope_id was added, which the
+// kernel still accepts
+#ifndef SIN6_LEN_RFC2133
+#define SIN6_LEN_RFC2133 24
+#endif
+
+// This class detects if a socket address (the destination of connect() or
+// sendto(), or the local address of bind()) is allowed by the sandbox
+class AddressDetector {
+ public:
+  // _allowlist_ is a comma-delimited list of CIDR[:port[-port]] entries, e.g.
+  // "127.0.0.0/8,10.0.0.1:53,[::1]/128:8000-8999". IPv6 addresses are written
+  // in brackets. An entry without a port allows every port.
+  AddressDetector(std::string allowlist) {
+    if (allowlist.empty()) return;
+
+    std::stringstream ss(allowlist);
+    while (ss.good()) {
+      std::string entry;
+      getline(ss, entry, ',');
+      if (entry.empty()) continue;
+      Entry parsed;
+      if (!ParseEntry(entry, &parsed)) {
+        error_ = "Invalid allowlist entry: " + entry;
+        return;
+      }
+      entries_.push_back(parsed);
+    }
+  }
+
+  // Returns the first invalid entry, or an empty string if all entries are
+  // valid
+  const std::string& Error() const { return error_; }
+
+  // Returns true if no entry has been configured
+  bool Empty() const { return entries_.empty(); }
+
+  // Decide if the inet or inet6 address _addr_ of _len_ bytes is in the
+  // allowlist
+  // An inet6 address needs no sin6_scope_id, so only its first
+  // SIN6_LEN_RFC2133 bytes are read.
+  bool IsAllowed(const struct sockaddr* addr, size_t len) const {
+    int family;
+    uint8_t bytes[16];
+    uint16_t port;
+
+    if (addr->sa_family == AF_INET && len >= sizeof(struct sockaddr_in)) {
+      const struct sockaddr_in* in =
+          reinterpret_cast<const struct sockaddr_in*>(addr);
+      family = AF_INET;
+      memcpy(bytes, &in->sin_addr, 4);
+      port = ntohs(in->sin_port);
+    } else if (addr->sa_family == AF_INET6 && len >= SIN6_LEN_RFC2133) {
+      const struct sockaddr_in6* in6 =
+          reinterpret_cast<const struct sockaddr_in6*>(addr);
+      port = ntohs(in6->sin6_port);
+      if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+        // ::ffff:a.b.c.d is matched against the IPv4 entries
+        family = AF_INET;
+        memcpy(bytes, in6->sin6_addr.s6_addr + 12, 4);
+      } else {
+        family = AF_INET6;
+        memcpy(bytes, in6->sin6_addr.s6_addr, 16);
+      }
+    } else {
+      return false;
+    }
+
+    for (const auto& entry : entries_) {
+      if (entry.family == family && port >= entry.port_low &&
+          port <= entry.port_high && PrefixMatch(entry, bytes)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  struct Entry {
+    int family;          // AF_INET or AF_INET6
+    uint8_t addr[16];    // network address in network byte order
+    int prefix;          // prefix length in bits
+    uint16_t port_low;   // lowest port allowed
+    uint16_t port_high;  // highest port allowed
+  };
+
+  // Parse _entry_ into _result_. Returns false if _entry_ is malformed.
+  static bool ParseEntry(const std::string& entry, Entry* result) {
+    std::string host = entry;
+    std::string port;
+
+    // Split off the port, skipping over the colons of a bracketed IPv6 address
+    size_t host_end = 0;
+    if (!entry.empty() && entry[0] == '[') {
+      size_t bracket = entry.find(']');
+      if (bracket == std::string::npos) return false;
+      host_end = bracket;
+    }
+    size_t colon = entry.find(':', host_end);
+    if (colon != std::string::npos) {
+      host = entry.substr(0, colon);
+      port = entry.substr(colon + 1);
+    }
+
+    // Split off the prefix length
+    std::string prefix;
+    size_t slash = host.find('/');
+    if (slash != std::string::npos) {
+      prefix = host.substr(slash + 1);
+      host = host.substr(0, slash);
+    }
+    if (!host.empty() && host[0] == '[') {
+      host = host.substr(1, host.size() - 2);
+    }
+
+    memset(result->addr, 0, sizeof(result->addr));
+    if (inet_pton(AF_INET, host.c_str(), result->addr) == 1) {
+      result->family = AF_INET;
+      result->prefix = 32;
+    } else if (inet_pton(AF_INET6, host.c_str(), result->addr) == 1) {
+      result->family = AF_INET6;
+      result->prefix = 128;
+    } else {
+      return false;
+    }
+
+    // A slash must be followed by a prefix length, since a typo must not
+    // widen the entry to every address
+    if (slash != std::string::npos) {
+      long bits;
+      if (!ParseNumber(prefix, result->prefix, &bits)) return false;
+      result->prefix = static_cast<int>(bits);
+    }
+
+    result->port_low = 0;
+    result->port_high = 65535;
+    if (colon != std::string::npos && port != "*") {
+      size_t dash = port.find('-');
+      long low, high;
+      if (!ParseNumber(port.substr(0, dash), 65535, &low)) return false;
+      high = low;
+      if (dash != std::string::npos &&
+          !ParseNumber(port.substr(dash + 1), 65535, &high)) {
+        return false;
+      }
+      if (low > high) return false;
+      result->port_low = static_cast<uint16_t>(low);
+      result->port_high = static_cast<uint16_t>(high);
+    }
+    return true;
+  }
+
+  // Parse the decimal number _str_ into _value_
+  // Returns false unless all of _str_ is a number from 0 to _max_.
+  static bool ParseNumber(const std::string& str, long max, long* value) {
+    if (str.empty() || str[0] < '0' || str[0] > '9') return false;
+    char* end;
+    errno = 0;
+    *value = strtol(str.c_str(), &end, 10);
+    return errno == 0 && *end == '\0' && *value <= max;
+  }
+
+  // Decide if the first _entry.prefix_ bits of _bytes_ match the entry
+  static bool PrefixMatch(const Entry& entry, const uint8_t* bytes) {
+    int full_bytes = entry.prefix / 8;
+    if (memcmp(entry.addr, bytes, full_bytes) != 0) return false;
+    int rest = entry.prefix % 8;
+    if (rest == 0) return true;
+    uint8_t mask = static_cast<uint8_t>(0xff << (8 - rest));
+    return (entry.addr[full_bytes] & mask) == (bytes[full_bytes] & mask);
+  }
+
+  std::vector<Entry> entries_;  // allowed networks and port ranges
+  std::string error_;           // the first invalid entry
+};
+
+#endif  // ADDRESS_DETECTOR_HH
@@ -0,0 +1,47 @@
+#ifndef COMPILED_POLICY_HH
+#define COMPILED_POLICY_HH
+
+#include <string>
+
+#include "address_detector.hh"
+#include "file_detector.hh"
+#include "policy.hh"
+#include "program_detector.hh"
+#include "socket_detector.hh"
+
+// A policy with all its rules parsed, ready to check system calls against.
+// It is never modified once built, so every tracee shares one instance and a
+// reload swaps in a new one as a whole.
+struct CompiledPolicy {
+  CompiledPolicy(const Policy& policy)
+      : policy(policy),
+        read_file_detector(policy.read_file),
+        read_write_file_detector(policy.read_write_file),
+        socket_detector(policy.socket_allow),
+        connect_detector(policy.connect_allow),
+        bind_detector(policy.bind_allow),
+        trusted_detector(policy.trusted) {}
+
+  // Returns the first invalid rule, or an empty string if all rules are valid
+  std::string Error() const {
+    if (!read_file_detector.Error().empty()) return read_file_detector.Error();
+    if (!read_write_file_detector.Error().empty()) {
+      return read_write_file_detector.Error();
+    }
+    if (!socket_detector.Error().empty()) return socket_detector.Error();
+    if (!connect_detector.Error().empty()) return connect_detector.Error();
+    if (!bind_detector.Error().empty()) return bind_detector.Error();
+    if (!trusted_detector.Error().empty()) return trusted_detector.Error();
+    return "";
+  }
+
+  const Policy policy;                          // the policy as configured
+  const FileDetector read_file_detector;        // decides read permission
+  const FileDetector read_write_file_detector;  // decides write permission
+  const SocketDetector socket_detector;         // decides socket families
+  const AddressDetector connect_detector;       // decides connect() targets
+  const AddressDetector bind_detector;          // decides bind() addresses
+  const ProgramDetector trusted_detector;       // decides trusted programs
+};
+
+#endif  // COMPILED_POLICY_HH
@@ -0,0 +1,58 @@
+#include "cpu_affinity.hh"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+
+bool ParseCpuList(const std::string &list, cpu_set_t *cpus) {
+  CPU_ZERO(cpus);
+  std::stringstream ss(list);
+  while (ss.good()) {
+    std::string range;
+    getline(ss, range, ',');
+    if (range.empty() || range == "\n") continue;
+
+    char *end;
+    long low = strtol(range.c_str(), &end, 10);
+    long high = low;
+    if (*end == '-') high = strtol(end + 1, &end, 10);
+    if ((*end != '\0' && *end != '\n') || low < 0 || high < low ||
+        high >= CPU_SETSIZE) {
+      return false;
+    }
+    for (long cpu = low; cpu <= high; cpu++) CPU_SET(cpu, cpus);
+  }
+  return CPU_COUNT(cpus) != 0;
+}
+
+bool CurrentNodeCpus(cpu_set_t *cpus) {
+  int cpu = sched_getcpu();
+  if (cpu != -1) {
+    // The node of a CPU shows up as a nodeN entry in its sysfs directory
+    std::string cpu_dir =
+        "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/";
+    DIR *dir = opendir(cpu_dir.c_str());
+    if (dir != NULL) {
+      std::string node;
+      struct dirent *entry;
+      while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0) {
+          node = entry->d_name;
+          break;
+        }
+      }
+      closedir(dir);
+
+      std::ifstream cpulist("/sys/devices/system/node/" + node + "/cpulist");
+      std::string list;
+      if (!node.empty() && getline(cpulist, list) &&
+          ParseCpuList(list, cpus)) {
+        return true;
+      }
+    }
+  }
+  return sched_getaffinity(0, sizeof(cpu_set_t), cpus) == 0;
+}
@@ -0,0 +1,16 @@
+#ifndef CPU_AFFINITY_HH
+#define CPU_AFFINITY_HH
+
+#include <sched.h>
+#include <string>
+
+// Parse a CPU list such as "0-3,8,10-11" into _cpus_
+// Returns false if _list_ is malformed or empty.
+bool ParseCpuList(const std::string& list, cpu_set_t* cpus);
+
+// Store the CPUs of the NUMA node the calling thread runs on in _cpus_
+// Without NUMA information, every CPU the thread may run on is stored.
+// Returns false if the CPUs cannot be found.
+bool CurrentNodeCpus(cpu_set_t* cpus);
+
+#endif  // CPU_AFFINITY_HH
@@ -16,8 +16,10 @@ class FileDetector {
  public:
   FileDetector(std::string whitelist) {
     char* tmp;
-    REQUIRE((tmp = realpath(".", NULL)) != NULL) << "realpath() failed: "
-                                                 << strerror(errno);
+    if ((tmp = realpath(".", NULL)) == NULL) {
+      error_ = std::string("realpath() failed: ") + strerror(errno);
+      return;
+    }
     cur_path_ = std::string(tmp) + "/";
     free(tmp);
 
@@ -31,10 +33,13 @@ class FileDetector {
     }
   }
 
+  // Returns why the detector could not be set up, or an empty string
+  const std::string& Error() const { return error_; }
+
   // Decide if the file _file_ is a subdirectory of the whitelist
   // _file_ can be a relative or absolute path
   bool IsAllowed(std::string file) const {
-    if (whitelists_.empty()) {
+    if (whitelists_.empty() || file.empty()) {
       return false;
     }
 
@@ -54,10 +59,25 @@ class FileDetector {
     return false;
   }
 
+  // Returns the longest directory of the whitelist the file _file_ is in, or
+  // an empty string if there is none
+  std::string Match(std::string file) const {
+    std::string match;
+    if (file.empty()) return match;
+    if (file[0] != '/') file = cur_path_ + file;
+    for (const auto& str : whitelists_) {
+      if (str.size() > match.size() && file.find(str) != std::string::npos) {
+        match = str;
+      }
+    }
+    return match;
+  }
+
  private:
   std::string cur_path_;  // current path
   std::unordered_set<std::string>
       whitelists_;  // directory and its subdirectory permitted to read or write
+  std::string error_;  // why the detector could not be set up
 };
 
 #endif  // FILE_DETECTOR_HH
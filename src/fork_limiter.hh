@@ -0,0 +1,108 @@
+#ifndef FORK_LIMITER_HH
+#define FORK_LIMITER_HH
+
+#include <stddef.h>
+#include <algorithm>
+#include <string>
+
+#include "monotonic_clock.hh"
+#include "policy.hh"
+
+// This class decides if a tracee may create another process, based on the
+// number of live processes, the total number of forks and the fork rate.
+// Every decision takes constant time and memory.
+class ForkLimiter {
+ public:
+  // What to do with a fork that exceeds a limit
+  enum Action {
+    KILL,  // kill the program
+    FAIL   // make fork() fail with EAGAIN and let the program go on
+  };
+
+  // Limits are taken from _policy_. A limit of 0 means unlimited. The fork
+  // burst defaults to the fork rate.
+  ForkLimiter(const Policy& policy)
+      : max_processes_(policy.max_processes),
+        max_processes_action_(ParseAction(policy.max_processes_action)),
+        max_forks_(policy.max_forks),
+        max_forks_action_(ParseAction(policy.max_forks_action)),
+        total_forks_(0),
+        fork_rate_(policy.fork_rate),
+        fork_burst_(policy.fork_burst != 0 ? policy.fork_burst
+                                           : policy.fork_rate),
+        fork_rate_action_(ParseAction(policy.fork_rate_action)),
+        tokens_(static_cast<double>(fork_burst_)),
+        last_refill_(Now()) {}
+
+  // Enforce the limits of _policy_ from now on. Forks counted so far and the
+  // tokens left in the bucket, if there was one, are kept.
+  void Update(const Policy& policy) {
+    ForkLimiter limiter(policy);
+    limiter.total_forks_ = total_forks_;
+    if (fork_rate_ != 0) {
+      limiter.tokens_ =
+          std::min(tokens_, static_cast<double>(limiter.fork_burst_));
+      limiter.last_refill_ = last_refill_;
+    }
+    *this = limiter;
+  }
+
+  // Returns the first invalid action, or an empty string if all actions are
+  // valid
+  const std::string& Error() const { return error_; }
+
+  // Decide if a new process may be created while _live_processes_ tracees
+  // (including the new one) are running
+  // Returns an empty string if so. Otherwise returns the violated limit and
+  // stores its action in _action_.
+  std::string Admit(size_t live_processes, Action* action) {
+    if (max_processes_ != 0 && live_processes > max_processes_) {
+      *action = max_processes_action_;
+      return "max_processes";
+    }
+    if (max_forks_ != 0 && total_forks_ >= max_forks_) {
+      *action = max_forks_action_;
+      return "max_forks";
+    }
+    if (fork_rate_ != 0) {
+      // Refill the token bucket for the time passed since the last fork
+      double now = Now();
+      tokens_ = std::min(static_cast<double>(fork_burst_),
+                         tokens_ + (now - last_refill_) * fork_rate_);
+      last_refill_ = now;
+      if (tokens_ < 1) {
+        *action = fork_rate_action_;
+        return "fork_rate";
+      }
+      tokens_ -= 1;
+    }
+    total_forks_++;
+    return "";
+  }
+
+  // Returns the number of forks admitted so far
+  size_t TotalForks() const { return total_forks_; }
+
+ private:
+  Action ParseAction(const std::string& action) {
+    if (action == "fail") return FAIL;
+    if (action != "kill" && !action.empty()) {
+      error_ = "Unknown fork limit action: " + action;
+    }
+    return KILL;
+  }
+
+  std::string error_;              // the first invalid action
+  size_t max_processes_;           // maximum number of live processes
+  Action max_processes_action_;    // action when max_processes_ is exceeded
+  size_t max_forks_;               // maximum number of forks in total
+  Action max_forks_action_;        // action when max_forks_ is exceeded
+  size_t total_forks_;             // number of forks admitted so far
+  size_t fork_rate_;               // forks per second refilled into the bucket
+  size_t fork_burst_;              // capacity of the token bucket
+  Action fork_rate_action_;        // action when the bucket is empty
+  double tokens_;                  // forks currently available in the bucket
+  double last_refill_;             // time of the last refill in seconds
+};
+
+#endif  // FORK_LIMITER_HH
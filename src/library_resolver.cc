@@ -0,0 +1,326 @@
+#include "library_resolver.hh"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+// The loader's configuration files, read by every dynamic program
+#define LD_CACHE "/etc/ld.so.cache"
+#define LD_PRELOAD "/etc/ld.so.preload"
+
+// The formats of /etc/ld.so.cache. The old one may carry the new one after
+// its entries.
+#define CACHE_MAGIC_OLD "ld.so-1.7.0"
+#define CACHE_MAGIC_NEW "glibc-ld.so.cache1.1"
+#define CACHE_ENTRY_OLD 12  // flags, name and path offsets
+#define CACHE_ENTRY_NEW 24  // the same, plus the OS version and hwcaps
+#define CACHE_HEADER_OLD 16
+#define CACHE_HEADER_NEW 48
+
+// Cache entries of 64-bit x86 libraries, the only ones this program loads
+#define CACHE_FLAGS_X8664 0x0303
+
+// The subdirectories the loader tries before each directory it searches
+static const char *const kHwcapsDirs[] = {
+    "glibc-hwcaps/x86-64-v4/", "glibc-hwcaps/x86-64-v3/",
+    "glibc-hwcaps/x86-64-v2/", ""};
+
+// The directories searched after everything else
+static const char *const kDefaultDirs[] = {
+    "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib64",
+    "/usr/lib64", "/lib", "/usr/lib"};
+
+// What the loader needs to know about an ELF file
+struct ElfObject {
+  std::string interpreter;           // PT_INTERP, empty for static programs
+  std::vector<std::string> needed;   // DT_NEEDED
+  std::string rpath;                 // DT_RPATH
+  std::string runpath;               // DT_RUNPATH
+};
+
+// Returns a null-terminated string at _offset_ of _data_, or an empty string
+// if _offset_ is out of range
+static std::string StringAt(const std::string &data, size_t offset) {
+  if (offset >= data.size()) return "";
+  return std::string(data.c_str() + offset);
+}
+
+// Returns a little-endian 32-bit integer at _offset_ of _data_
+static uint32_t Uint32At(const std::string &data, size_t offset) {
+  uint32_t value = 0;
+  if (offset + sizeof(value) <= data.size()) {
+    memcpy(&value, data.data() + offset, sizeof(value));
+  }
+  return value;
+}
+
+// Read _path_ as a 64-bit ELF file into _object_
+// Returns false if it is not one.
+static bool ReadElf(const std::string &path, ElfObject *object) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+
+  ElfObject result;
+  Elf64_Ehdr header;
+  std::vector<Elf64_Phdr> segments;
+  bool ok = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+            memcmp(header.e_ident, ELFMAG, SELFMAG) == 0 &&
+            header.e_ident[EI_CLASS] == ELFCLASS64 &&
+            header.e_machine == EM_X86_64 &&
+            header.e_phentsize == sizeof(Elf64_Phdr);
+  if (ok) {
+    segments.resize(header.e_phnum);
+    size_t size = segments.size() * sizeof(Elf64_Phdr);
+    ok = pread(fd, segments.data(), size, header.e_phoff) ==
+         static_cast<ssize_t>(size);
+  }
+
+  std::vector<Elf64_Dyn> dynamic;
+  for (size_t i = 0; ok && i < segments.size(); i++) {
+    const Elf64_Phdr &segment = segments[i];
+    if (segment.p_type == PT_INTERP && segment.p_filesz < PATH_MAX) {
+      std::string interpreter(segment.p_filesz, '\0');
+      ok = pread(fd, &interpreter[0], segment.p_filesz, segment.p_offset) ==
+           static_cast<ssize_t>(segment.p_filesz);
+      result.interpreter = interpreter.c_str();
+    } else if (segment.p_type == PT_DYNAMIC) {
+      dynamic.resize(segment.p_filesz / sizeof(Elf64_Dyn));
+      size_t size = dynamic.size() * sizeof(Elf64_Dyn);
+      ok = pread(fd, dynamic.data(), size, segment.p_offset) ==
+           static_cast<ssize_t>(size);
+    }
+  }
+
+  // The dynamic section names its string table by address, which is found
+  // in the file through the segment loading it
+  Elf64_Addr strtab = 0;
+  Elf64_Xword strsz = 0;
+  for (const Elf64_Dyn &entry : dynamic) {
+    if (entry.d_tag == DT_STRTAB) strtab = entry.d_un.d_ptr;
+    if (entry.d_tag == DT_STRSZ) strsz = entry.d_un.d_val;
+  }
+  std::string strings;
+  for (size_t i = 0; ok && strsz != 0 && i < segments.size(); i++) {
+    const Elf64_Phdr &segment = segments[i];
+    if (segment.p_type == PT_LOAD && strtab >= segment.p_vaddr &&
+        strtab + strsz <= segment.p_vaddr + segment.p_filesz) {
+      strings.resize(strsz);
+      off_t offset = segment.p_offset + (strtab - segment.p_vaddr);
+      ok = pread(fd, &strings[0], strsz, offset) ==
+           static_cast<ssize_t>(strsz);
+      break;
+    }
+  }
+  close(fd);
+  if (!ok) return false;
+
+  for (const Elf64_Dyn &entry : dynamic) {
+    if (entry.d_tag == DT_NEEDED) {
+      result.needed.push_back(StringAt(strings, entry.d_un.d_val));
+    } else if (entry.d_tag == DT_RPATH) {
+      result.rpath = StringAt(strings, entry.d_un.d_val);
+    } else if (entry.d_tag == DT_RUNPATH) {
+      result.runpath = StringAt(strings, entry.d_un.d_val);
+    }
+  }
+  *object = result;
+  return true;
+}
+
+// Returns the paths of the libraries in /etc/ld.so.cache by name, in the
+// order the loader prefers them
+static std::unordered_map<std::string, std::vector<std::string>>
+ReadLdCache() {
+  std::unordered_map<std::string, std::vector<std::string>> libraries;
+  std::ifstream in(LD_CACHE, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+
+  // Where the entries start, how long each is, and where the offsets of
+  // their strings count from
+  size_t entries, entry_size, base;
+  size_t nlibs;
+  if (data.compare(0, strlen(CACHE_MAGIC_NEW), CACHE_MAGIC_NEW) == 0) {
+    base = 0;
+    nlibs = Uint32At(data, base + strlen(CACHE_MAGIC_NEW));
+    entries = base + CACHE_HEADER_NEW;
+    entry_size = CACHE_ENTRY_NEW;
+  } else if (data.compare(0, strlen(CACHE_MAGIC_OLD), CACHE_MAGIC_OLD) == 0) {
+    nlibs = Uint32At(data, CACHE_HEADER_OLD - sizeof(uint32_t));
+    size_t end = CACHE_HEADER_OLD + nlibs * CACHE_ENTRY_OLD;
+    size_t next = (end + 7) & ~static_cast<size_t>(7);
+    if (data.compare(next, strlen(CACHE_MAGIC_NEW), CACHE_MAGIC_NEW) == 0) {
+      base = next;
+      nlibs = Uint32At(data, base + strlen(CACHE_MAGIC_NEW));
+      entries = base + CACHE_HEADER_NEW;
+      entry_size = CACHE_ENTRY_NEW;
+    } else {
+      base = end;
+      entries = CACHE_HEADER_OLD;
+      entry_size = CACHE_ENTRY_OLD;
+    }
+  } else {
+    return libraries;
+  }
+
+  for (size_t i = 0; i < nlibs; i++) {
+    size_t entry = entries + i * entry_size;
+    if (entry + CACHE_ENTRY_OLD > data.size()) break;
+    if (Uint32At(data, entry) != CACHE_FLAGS_X8664) continue;
+    std::string name = StringAt(data, base + Uint32At(data, entry + 4));
+    std::string path = StringAt(data, base + Uint32At(data, entry + 8));
+    if (!name.empty() && !path.empty()) libraries[name].push_back(path);
+  }
+  return libraries;
+}
+
+// Add _path_ and its real path to _files_
+static void AddFile(const std::string &path,
+                    std::unordered_set<std::string> *files) {
+  files->insert(path);
+  char real_path[PATH_MAX];
+  if (realpath(path.c_str(), real_path) != NULL) files->insert(real_path);
+}
+
+// Returns the directory of the real path of _path_, which $ORIGIN stands for
+static std::string Origin(const std::string &path) {
+  char real_path[PATH_MAX];
+  if (realpath(path.c_str(), real_path) == NULL) return "";
+  std::string origin(real_path);
+  return origin.substr(0, origin.rfind('/'));
+}
+
+// Append the directories of the colon-separated _list_ to _dirs_, with
+// $ORIGIN replaced by _origin_
+static void SplitPath(const std::string &list, const std::string &origin,
+                      std::vector<std::string> *dirs) {
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(':', start);
+    if (end == std::string::npos) end = list.size();
+    std::string dir = list.substr(start, end - start);
+    for (const char *token : {"${ORIGIN}", "$ORIGIN"}) {
+      size_t pos;
+      while ((pos = dir.find(token)) != std::string::npos) {
+        dir.replace(pos, strlen(token), origin);
+      }
+    }
+    if (!dir.empty()) dirs->push_back(dir);
+    start = end + 1;
+  }
+}
+
+// Search _dirs_ for the library _name_ as the loader does, adding every path
+// tried to _files_
+// Returns the path found and stores the library in _library_, or returns an
+// empty string if it is not in _dirs_.
+static std::string SearchDirs(const std::string &name,
+                              const std::vector<std::string> &dirs,
+                              ElfObject *library,
+                              std::unordered_set<std::string> *files) {
+  for (const std::string &dir : dirs) {
+    for (const char *hwcaps : kHwcapsDirs) {
+      std::string path = dir + "/" + hwcaps + name;
+      files->insert(path);
+      if (ReadElf(path, library)) {
+        AddFile(path, files);
+        return path;
+      }
+    }
+  }
+  return "";
+}
+
+// Returns the path of _program_ as execvp() finds it, or an empty string if
+// it is not found
+static std::string FindProgram(const std::string &program) {
+  if (program.find('/') != std::string::npos) return program;
+  const char *env = getenv("PATH");
+  std::vector<std::string> dirs;
+  SplitPath(env != NULL ? env : "/bin:/usr/bin", "", &dirs);
+  for (const std::string &dir : dirs) {
+    std::string path = dir + "/" + program;
+    if (access(path.c_str(), X_OK) == 0) return path;
+  }
+  return "";
+}
+
+std::unordered_set<std::string> ResolveLoaderFiles(
+    const std::string &program) {
+  std::unordered_set<std::string> files = {LD_CACHE, LD_PRELOAD};
+  std::string path = FindProgram(program);
+  if (path.empty()) return files;
+  AddFile(path, &files);
+
+  ElfObject executable;
+  if (!ReadElf(path, &executable) || executable.interpreter.empty()) {
+    return files;
+  }
+  AddFile(executable.interpreter, &files);
+
+  std::unordered_map<std::string, std::vector<std::string>> cache =
+      ReadLdCache();
+  std::vector<std::string> library_path;
+  const char *env = getenv("LD_LIBRARY_PATH");
+  if (env != NULL) SplitPath(env, Origin(path), &library_path);
+  std::vector<std::string> default_dirs(std::begin(kDefaultDirs),
+                                        std::end(kDefaultDirs));
+
+  // Libraries are loaded breadth first, each name only once
+  std::unordered_set<std::string> loaded;
+  std::deque<std::pair<std::string, ElfObject>> pending;
+  pending.emplace_back(path, executable);
+  while (!pending.empty()) {
+    std::string object_path = pending.front().first;
+    ElfObject object = pending.front().second;
+    pending.pop_front();
+
+    // RPATH applies unless the object has a RUNPATH, and the executable's
+    // RPATH applies to every library
+    std::string origin = Origin(object_path);
+    std::vector<std::string> dirs;
+    if (object.runpath.empty()) {
+      SplitPath(object.rpath, origin, &dirs);
+      if (object_path != path && executable.runpath.empty()) {
+        SplitPath(executable.rpath, Origin(path), &dirs);
+      }
+    }
+    dirs.insert(dirs.end(), library_path.begin(), library_path.end());
+    SplitPath(object.runpath, origin, &dirs);
+
+    for (const std::string &name : object.needed) {
+      if (name.empty() || !loaded.insert(name).second) continue;
+
+      ElfObject library;
+      if (name.find('/') != std::string::npos) {
+        // A path is loaded as is, without searching
+        AddFile(name, &files);
+        if (ReadElf(name, &library)) pending.emplace_back(name, library);
+        continue;
+      }
+
+      std::string found = SearchDirs(name, dirs, &library, &files);
+      if (found.empty() && cache.count(name)) {
+        // The loader may pick any variant the cache lists for this CPU
+        for (const std::string &cached : cache[name]) {
+          AddFile(cached, &files);
+          if (found.empty() && ReadElf(cached, &library)) found = cached;
+        }
+      }
+      if (found.empty()) {
+        found = SearchDirs(name, default_dirs, &library, &files);
+      }
+      if (!found.empty()) pending.emplace_back(found, library);
+    }
+  }
+  return files;
+}
@@ -0,0 +1,16 @@
+#ifndef LIBRARY_RESOLVER_HH
+#define LIBRARY_RESOLVER_HH
+
+#include <string>
+#include <unordered_set>
+
+// Find _program_ the way execvp() does and resolve the shared libraries the
+// dynamic loader will load for it: its interpreter, its DT_NEEDED entries and
+// theirs, searched through RPATH, LD_LIBRARY_PATH, RUNPATH, /etc/ld.so.cache
+// and the default directories.
+// Returns every path the loader opens to start the program, the real path of
+// each, and the loader's own configuration files. A static or unreadable
+// program only yields the program itself.
+std::unordered_set<std::string> ResolveLoaderFiles(const std::string& program);
+
+#endif  // LIBRARY_RESOLVER_HH
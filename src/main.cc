@@ -0,0 +1,97 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+#include "policy.hh"
+#include "sandbox.hh"
+
+// Reload _config_file_ into _sandbox_ every time the sandbox receives SIGHUP
+// SIGHUP must be blocked in every thread.
+static void ReloadOnSighup(Sandbox *sandbox, std::string config_file) {
+  sigset_t sighup;
+  sigemptyset(&sighup);
+  sigaddset(&sighup, SIGHUP);
+  while (true) {
+    int sig;
+    if (sigwait(&sighup, &sig) != 0) continue;
+
+    // Keys missing from the file fall back to their defaults
+    Policy policy;
+    std::string error;
+    if (!ParseConfig(config_file, &policy, &error) ||
+        !(error = sandbox->UpdatePolicy(policy)).empty()) {
+      WARNING << "Keeping the current policy: " << error;
+    } else {
+      INFO << "Reloaded " << config_file;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cout << "Usage: ./sandbox (config_file) -- program arg1 arg2 ..."
+              << std::endl;
+    exit(1);
+  }
+
+  Policy policy;
+  int program_index;
+  if (std::string(argv[1]) == "--") {
+    // Without config file
+    program_index = 2;
+  } else {
+    // With config file
+    std::string error;
+    REQUIRE(ParseConfig(argv[1], &policy, &error)) << error;
+    program_index = 3;
+  }
+  std::vector<std::string> program(argv + program_index, argv + argc);
+
+  Sandbox sandbox(policy);
+
+  // With a config file, SIGHUP reloads it into the running program
+  if (program_index == 3) {
+    sigset_t sighup;
+    sigemptyset(&sighup);
+    sigaddset(&sighup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sighup, NULL);
+    std::thread(ReloadOnSighup, &sandbox, std::string(argv[1])).detach();
+  }
+
+  SandboxResult result = sandbox.Run(program);
+  REQUIRE(result.error.empty()) << result.error;
+
+  if (!result.violation.empty()) {
+    LOG(ccutil::FatalColor, false) << "Process " << result.violating_pid
+                                   << ": " << result.violation;
+  }
+  std::cerr << "Sandbox summary: "
+            << (result.exited ? "exit status " : "terminated by signal ")
+            << (result.exited ? result.exit_status : result.term_signal)
+            << ", " << result.stats.syscalls << " syscalls, "
+            << result.stats.forks << " forks, " << result.stats.execs
+            << " execs, " << result.stats.peak_processes
+            << " peak processes, " << result.stats.peak_threads
+            << " peak threads, " << result.stats.wall_time << " s";
+  if (!policy.stdout_file.empty() || !policy.stderr_file.empty()) {
+    std::cerr << ", " << result.stats.stdout_bytes << " bytes of stdout, "
+              << result.stats.stderr_bytes << " bytes of stderr captured, "
+              << result.stats.dropped_bytes << " bytes dropped";
+  }
+  if (policy.write_limit > 0 || policy.create_limit > 0 ||
+      policy.total_write_limit > 0 || policy.total_create_limit > 0) {
+    std::cerr << ", " << result.stats.bytes_written << " bytes written, "
+              << result.stats.files_created << " files created";
+  }
+  std::cerr << std::endl;
+  if (!result.profile.empty()) PrintProfile(result.profile, std::cerr);
+
+  // A violation fails the run even if the program handled the kill
+  if (!result.violation.empty()) return 1;
+  return result.exited ? result.exit_status : 128 + result.term_signal;
+}
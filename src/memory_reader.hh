@@ -0,0 +1,19 @@
+#ifndef MEMORY_READER_HH
+#define MEMORY_READER_HH
+
+#include <stddef.h>
+#include <string>
+
+// An interface to read the memory of a process whose system call is checked
+class MemoryReader {
+ public:
+  virtual ~MemoryReader() {}
+
+  // Read a null-terminated string out of address _addr_
+  virtual std::string operator[](void* addr) const = 0;
+
+  // Read _len_ raw bytes out of address _addr_
+  virtual std::string Read(void* addr, size_t len) const = 0;
+};
+
+#endif  // MEMORY_READER_HH
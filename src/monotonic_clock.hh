@@ -0,0 +1,13 @@
+#ifndef MONOTONIC_CLOCK_HH
+#define MONOTONIC_CLOCK_HH
+
+#include <time.h>
+
+// Returns the monotonic time in seconds
+inline double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif  // MONOTONIC_CLOCK_HH
@@ -0,0 +1,103 @@
+#include "output_capture.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "log.h"
+
+// The most bytes moved by one splice() call, and the pipe size asked for
+#define CAPTURE_CHUNK (1 << 20)
+
+OutputCapture::OutputCapture(const std::string &file, long long limit)
+    : limit_(limit > 0 ? limit : 0) {
+  file_ = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file_ == -1) {
+    error_ = "Cannot open " + file + ": " + strerror(errno);
+    return;
+  }
+  null_ = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (null_ == -1 || pipe2(pipe_, O_CLOEXEC) == -1) {
+    error_ = std::string("Cannot create a pipe for output: ") +
+             strerror(errno);
+    return;
+  }
+
+  // Only the sandbox reads the pipe, and it must never block on it. A larger
+  // pipe lets a chatty program write longer before it waits for the sandbox;
+  // the size is capped by /proc/sys/fs/pipe-max-size.
+  fcntl(pipe_[0], F_SETFL, O_NONBLOCK);
+  fcntl(pipe_[0], F_SETPIPE_SZ, CAPTURE_CHUNK);
+}
+
+OutputCapture::~OutputCapture() {
+  for (int fd : {pipe_[0], pipe_[1], file_, null_}) {
+    if (fd != -1) close(fd);
+  }
+}
+
+void OutputCapture::CloseWriteEnd() {
+  if (pipe_[1] != -1) close(pipe_[1]);
+  pipe_[1] = -1;
+}
+
+bool OutputCapture::Drain() {
+  while (true) {
+    bool keep = file_ != -1 && (limit_ == 0 || captured_ < limit_);
+    size_t len = CAPTURE_CHUNK;
+    if (keep && limit_ != 0) len = std::min(len, limit_ - captured_);
+
+    ssize_t moved = splice(pipe_[0], NULL, keep ? file_ : null_, NULL, len,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved == 0) return false;
+    if (moved == -1) {
+      if (errno == EAGAIN) return true;
+      if (errno == EINTR) continue;
+      if (!keep) return false;
+
+      // Keep the program from blocking on a full pipe, e.g. if the disk is
+      // full, by dropping the rest of its output
+      WARNING << "Cannot capture output: " << strerror(errno);
+      close(file_);
+      file_ = -1;
+      continue;
+    }
+    if (keep) {
+      captured_ += moved;
+    } else {
+      dropped_ += moved;
+    }
+  }
+}
+
+void CaptureOutput(std::vector<OutputCapture *> captures, int stop_fd,
+                   std::function<void()> overflowed) {
+  bool overflow = false;
+  while (true) {
+    std::vector<struct pollfd> fds = {{stop_fd, POLLIN, 0}};
+    for (OutputCapture *capture : captures) {
+      fds.push_back({capture->ReadEnd(), POLLIN, 0});
+    }
+    if (poll(fds.data(), fds.size(), -1) == -1) {
+      if (errno == EINTR) continue;
+      WARNING << "poll failed: " << strerror(errno);
+      return;
+    }
+
+    // Pipes are dropped from the poll set once every writer has closed them
+    bool stop = fds[0].revents != 0;
+    for (size_t i = captures.size(); i-- > 0;) {
+      bool still_open = !stop && fds[i + 1].revents == 0;
+      if (!still_open) still_open = captures[i]->Drain();
+      if (captures[i]->Dropped() != 0 && !overflow) {
+        overflow = true;
+        overflowed();
+      }
+      if (!still_open) captures.erase(captures.begin() + i);
+    }
+    if (stop) return;
+  }
+}
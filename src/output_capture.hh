@@ -0,0 +1,57 @@
+#ifndef OUTPUT_CAPTURE_HH
+#define OUTPUT_CAPTURE_HH
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// This class captures what a program writes to one of its standard streams in
+// a file. The program writes into a pipe, whose data is moved into the file
+// with splice(), so it is never copied through user space. Past _limit_
+// bytes (0 for no limit), data is moved into /dev/null instead.
+class OutputCapture {
+ public:
+  OutputCapture(const std::string& file, long long limit);
+  ~OutputCapture();
+
+  // Returns why the output cannot be captured, or an empty string
+  const std::string& Error() const { return error_; }
+
+  // Returns the end of the pipe the program writes into
+  int WriteEnd() const { return pipe_[1]; }
+
+  // Close the end of the pipe the program writes into, once the program has
+  // been started with it
+  void CloseWriteEnd();
+
+  // Returns the end of the pipe the output is moved from
+  int ReadEnd() const { return pipe_[0]; }
+
+  // Move everything in the pipe into the file without blocking
+  // Returns false once every writer has closed the pipe.
+  bool Drain();
+
+  // Returns the number of bytes written into the file
+  size_t Captured() const { return captured_; }
+
+  // Returns the number of bytes discarded past the limit
+  size_t Dropped() const { return dropped_; }
+
+ private:
+  int pipe_[2] = {-1, -1};   // the pipe the program writes into
+  int file_ = -1;            // the file the output is captured in
+  int null_ = -1;            // /dev/null, where output past the limit goes
+  size_t limit_;             // bytes to capture at most, or 0 for no limit
+  size_t captured_ = 0;      // bytes written into the file
+  size_t dropped_ = 0;       // bytes discarded past the limit
+  std::string error_;        // why the output cannot be captured
+};
+
+// Move the output of _captures_ into their files until every writer has
+// closed the pipes and _stop_fd_ is readable
+// _overflowed_ is called once, as soon as any output is dropped.
+void CaptureOutput(std::vector<OutputCapture*> captures, int stop_fd,
+                   std::function<void()> overflowed);
+
+#endif  // OUTPUT_CAPTURE_HH
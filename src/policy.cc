@@ -0,0 +1,123 @@
+#include "policy.hh"
+
+#include <libconfig.h++>
+#include <sstream>
+#include <utility>
+
+#include "compiled_policy.hh"
+#include "cpu_affinity.hh"
+#include "fork_limiter.hh"
+#include "write_quota.hh"
+
+using libconfig::Config;
+using libconfig::FileIOException;
+using libconfig::ParseException;
+
+bool ParseConfig(const std::string &config_file, Policy *policy,
+                 std::string *error) {
+  Config cfg;
+
+  // Read the file. If there is an error, report it.
+  try {
+    cfg.readFile(config_file.c_str());
+  } catch (const FileIOException &fioex) {
+    *error = "I/O error while reading file.";
+    return false;
+  } catch (const ParseException &pex) {
+    std::stringstream ss;
+    ss << "Parse error at " << pex.getFile() << ":" << pex.getLine() << " - "
+       << pex.getError();
+    *error = ss.str();
+    return false;
+  }
+
+  // Parse variables
+  // If variable name cannot be found, passed in variables witll not be changed
+  cfg.lookupValue("read", policy->read_file);
+  cfg.lookupValue("read_write", policy->read_write_file);
+  cfg.lookupValue("write_limit", policy->write_limit);
+  cfg.lookupValue("create_limit", policy->create_limit);
+  cfg.lookupValue("total_write_limit", policy->total_write_limit);
+  cfg.lookupValue("total_create_limit", policy->total_create_limit);
+  cfg.lookupValue("write_limit_action", policy->write_limit_action);
+  cfg.lookupValue("read_libraries", policy->read_libraries);
+  cfg.lookupValue("fork", policy->forkable);
+  cfg.lookupValue("exec", policy->execable);
+  cfg.lookupValue("trusted", policy->trusted);
+  cfg.lookupValue("socket", policy->socketable);
+  cfg.lookupValue("socket_allow", policy->socket_allow);
+  cfg.lookupValue("connect_allow", policy->connect_allow);
+  cfg.lookupValue("bind_allow", policy->bind_allow);
+  cfg.lookupValue("max_processes", policy->max_processes);
+  cfg.lookupValue("max_processes_action", policy->max_processes_action);
+  cfg.lookupValue("max_forks", policy->max_forks);
+  cfg.lookupValue("max_forks_action", policy->max_forks_action);
+  cfg.lookupValue("fork_rate", policy->fork_rate);
+  cfg.lookupValue("fork_burst", policy->fork_burst);
+  cfg.lookupValue("fork_rate_action", policy->fork_rate_action);
+  cfg.lookupValue("profile", policy->profile);
+  cfg.lookupValue("profile_trace", policy->profile_trace);
+  cfg.lookupValue("record", policy->record);
+  cfg.lookupValue("affinity", policy->affinity);
+  cfg.lookupValue("cpus", policy->cpus);
+  cfg.lookupValue("busy_poll_us", policy->busy_poll_us);
+  cfg.lookupValue("stdout_file", policy->stdout_file);
+  cfg.lookupValue("stderr_file", policy->stderr_file);
+  cfg.lookupValue("output_limit", policy->output_limit);
+  cfg.lookupValue("output_limit_action", policy->output_limit_action);
+  return true;
+}
+
+std::string CheckPolicy(const Policy &policy,
+                        std::shared_ptr<const CompiledPolicy> *compiled) {
+  std::shared_ptr<const CompiledPolicy> result =
+      std::make_shared<const CompiledPolicy>(policy);
+  std::string error = CheckPolicy(*result);
+  if (compiled != nullptr && error.empty()) *compiled = result;
+  return error;
+}
+
+std::string CheckPolicy(const CompiledPolicy &compiled) {
+  const Policy &policy = compiled.policy;
+  std::string error = compiled.Error();
+  if (!error.empty()) return error;
+
+  // Limits of 0 are off, and none of them can be negative
+  const std::pair<const char *, long long> limits[] = {
+      {"write_limit", policy.write_limit},
+      {"create_limit", policy.create_limit},
+      {"total_write_limit", policy.total_write_limit},
+      {"total_create_limit", policy.total_create_limit},
+      {"max_processes", policy.max_processes},
+      {"max_forks", policy.max_forks},
+      {"fork_rate", policy.fork_rate},
+      {"fork_burst", policy.fork_burst},
+      {"busy_poll_us", policy.busy_poll_us},
+      {"output_limit", policy.output_limit},
+  };
+  for (const auto &limit : limits) {
+    if (limit.second < 0) {
+      return std::string("Negative ") + limit.first + ": " +
+             std::to_string(limit.second);
+    }
+  }
+
+  if (policy.affinity != "none" && policy.affinity != "node" &&
+      policy.affinity != "cpus") {
+    return "Unknown affinity: " + policy.affinity;
+  }
+  cpu_set_t cpus;
+  if (policy.affinity == "cpus" && !ParseCpuList(policy.cpus, &cpus)) {
+    return "Invalid CPU list: " + policy.cpus;
+  }
+
+  if (policy.output_limit_action != "truncate" &&
+      policy.output_limit_action != "kill") {
+    return "Unknown output limit action: " + policy.output_limit_action;
+  }
+
+  error = WriteQuota(policy).Error();
+  if (!error.empty()) return error;
+
+  return ForkLimiter(policy).Error();
+}
@@ -0,0 +1,65 @@
+#ifndef POLICY_HH
+#define POLICY_HH
+
+#include <memory>
+#include <string>
+
+// The restrictions a sandbox enforces on a program and all its children.
+// Every field mirrors the configuration file key of the same meaning (see
+// README.md); the defaults grant no privilege at all.
+struct Policy {
+  std::string read_file;          // directories permitted to read
+  std::string read_write_file;    // directories permitted to read and write
+  long long write_limit = 0;      // bytes written under each read_write root
+  int create_limit = 0;           // files created under each read_write root
+  long long total_write_limit = 0;  // bytes written under all of them
+  int total_create_limit = 0;     // files created under all of them
+  std::string write_limit_action = "kill";    // "kill" or "fail"
+  bool read_libraries = false;    // able to read the libraries it links
+  bool forkable = false;          // able to fork or not
+  bool execable = false;          // able to exec or not
+  std::string trusted;            // programs run without checking each call
+  bool socketable = false;        // able to do socket operation or not
+  std::string socket_allow;       // socket families and types permitted
+  std::string connect_allow;      // connect() and sendto() destinations
+  std::string bind_allow;         // bind() addresses permitted
+  int max_processes = 0;          // maximum number of live processes
+  std::string max_processes_action = "kill";  // "kill" or "fail"
+  int max_forks = 0;              // maximum number of forks in total
+  std::string max_forks_action = "kill";      // "kill" or "fail"
+  int fork_rate = 0;              // maximum number of forks per second
+  int fork_burst = 0;             // forks allowed back to back
+  std::string fork_rate_action = "kill";      // "kill" or "fail"
+  bool profile = false;           // time every system call or not
+  std::string profile_trace;      // Chrome trace file of the timelines
+  std::string record;             // file to record checked system calls to
+  std::string affinity = "none";  // "none", "node" or "cpus"
+  std::string cpus;               // CPUs for the "cpus" affinity
+  int busy_poll_us = 0;           // microseconds to poll before blocking
+  std::string stdout_file;        // file to capture standard output in
+  std::string stderr_file;        // file to capture standard error in
+  long long output_limit = 0;     // bytes to capture per stream at most
+  std::string output_limit_action = "truncate";  // "truncate" or "kill"
+};
+
+// Parse the configuration file _config_file_ into _policy_
+// Keys missing from the file leave _policy_ unchanged. Returns false and
+// stores the reason in _error_ if the file cannot be read or parsed.
+bool ParseConfig(const std::string& config_file, Policy* policy,
+                 std::string* error);
+
+struct CompiledPolicy;
+
+// Check every rule of _policy_
+// Returns the first invalid rule, or an empty string if the policy is valid.
+// The policy is compiled to be checked. If _compiled_ is given, the compiled
+// policy is stored there, so it is not compiled twice.
+std::string CheckPolicy(
+    const Policy& policy,
+    std::shared_ptr<const CompiledPolicy>* compiled = nullptr);
+
+// Check every rule of the policy _compiled_ was compiled from, without
+// compiling it again
+std::string CheckPolicy(const CompiledPolicy& compiled);
+
+#endif  // POLICY_HH
@@ -0,0 +1,50 @@
+#ifndef PROGRAM_DETECTOR_HH
+#define PROGRAM_DETECTOR_HH
+
+#include <limits.h>
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+// This class detects if an executable is on a list of programs
+class ProgramDetector {
+ public:
+  // _programs_ is a comma-delimited list of paths to executables, e.g.
+  // "/usr/bin/gcc,/opt/db/bin/postgres". Relative paths and symbolic links are
+  // resolved once, so each program is matched by its real path.
+  ProgramDetector(std::string programs) {
+    if (programs.empty()) return;
+
+    std::stringstream ss(programs);
+    while (ss.good()) {
+      std::string program;
+      getline(ss, program, ',');
+      if (program.empty()) continue;
+
+      char real_path[PATH_MAX];
+      if (realpath(program.c_str(), real_path) == NULL) {
+        error_ = "Cannot find the program: " + program;
+        return;
+      }
+      programs_.insert(real_path);
+    }
+  }
+
+  // Returns the first invalid program, or an empty string if all are valid
+  const std::string& Error() const { return error_; }
+
+  // Returns true if no program has been configured
+  bool Empty() const { return programs_.empty(); }
+
+  // Decide if the executable at the real path _path_ is on the list
+  bool IsAllowed(const std::string& path) const {
+    return programs_.count(path) != 0;
+  }
+
+ private:
+  std::unordered_set<std::string> programs_;  // real paths of the programs
+  std::string error_;                         // the first invalid program
+};
+
+#endif  // PROGRAM_DETECTOR_HH
@@ -1,6 +1,7 @@
 #ifndef PTRACE_PEEK_HH
 #define PTRACE_PEEK_HH
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,41 +9,61 @@
 #include <sys/errno.h>
 #include <sys/ptrace.h>
 #include <sys/types.h>
+#include <algorithm>
+#include <string>
 
 #include "log.h"
+#include "memory_reader.hh"
 
 // This class provides a method to peek into trace's memory and read its data
-class PtracePeek {
+class PtracePeek : public MemoryReader {
  public:
   PtracePeek(pid_t child_pid) : child_pid_(child_pid){};
 
   // Peek into tracee's program and read a string out of address _addr_
-  std::string operator[](void* addr) const {
-    size_t num_count = 0;
-    char str[100];
-    bool if_break = false;
-    while (1) {
-      char* cur_str = str + num_count * sizeof(long);
+  // Reading stops at PATH_MAX bytes. If the memory cannot be read, the bytes
+  // read so far are returned.
+  std::string operator[](void* addr) const override {
+    std::string str;
+    while (str.size() < PATH_MAX) {
+      errno = 0;
       long ret =
           ptrace(PTRACE_PEEKDATA, child_pid_,
                  reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(addr) +
-                                         num_count * sizeof(long)),
+                                         str.size()),
                  0);
-      REQUIRE(ret != -1) << "ptrace PTRACE_PEEKDATA failed: "
-                         << strerror(errno);
-
-      memcpy(cur_str, &ret, sizeof(long));
-      for (size_t i = 0; i < sizeof(long); ++i) {
-        if (cur_str[i] == '\0') {
-          if_break = true;
-          break;
-        }
+      if (errno != 0) {
+        WARNING << "ptrace PTRACE_PEEKDATA failed: " << strerror(errno);
+        break;
       }
-      if (if_break) break;
-      num_count++;
+
+      const char* cur_str = reinterpret_cast<const char*>(&ret);
+      size_t len = strnlen(cur_str, sizeof(long));
+      str.append(cur_str, len);
+      if (len < sizeof(long)) break;
     }
+    return str;
+  }
 
-    return std::string(str);
+  // Peek into tracee's program and read _len_ raw bytes out of address _addr_
+  // If the memory cannot be read, the bytes read so far are returned.
+  std::string Read(void* addr, size_t len) const override {
+    std::string bytes;
+    for (size_t offset = 0; offset < len; offset += sizeof(long)) {
+      errno = 0;
+      long ret =
+          ptrace(PTRACE_PEEKDATA, child_pid_,
+                 reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(addr) +
+                                         offset),
+                 0);
+      if (errno != 0) {
+        WARNING << "ptrace PTRACE_PEEKDATA failed: " << strerror(errno);
+        break;
+      }
+      bytes.append(reinterpret_cast<const char*>(&ret),
+                   std::min(sizeof(long), len - offset));
+    }
+    return bytes;
   }
 
  private:
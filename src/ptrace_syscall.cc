@@ -1,83 +1,384 @@
 #include "ptrace_syscall.hh"
 
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
 
 using std::string;
 
-PtraceSyscall::PtraceSyscall(pid_t child_pid, string read, string read_write,
-                             bool socketable)
-    : child_pid_(child_pid),
-      read_file_detector_(read),
-      read_write_file_detector_(read_write),
-      socket_(socketable),
-      ptrace_peek_(child_pid) {
-  // Initilize handler_funcs_
-  handler_funcs_.insert(handler_funcs_.begin(), /*total_num_of_syscalls=*/314,
-                        &PtraceSyscall::DefaultHandler);
-  handler_funcs_[SYS_open] = &PtraceSyscall::OpenHandler;
-  handler_funcs_[SYS_stat] = &PtraceSyscall::StatHandler;
-  handler_funcs_[SYS_lstat] = &PtraceSyscall::LStatHandler;
-  handler_funcs_[SYS_socket] = &PtraceSyscall::SocketHandler;
-  handler_funcs_[SYS_clone] = &PtraceSyscall::CloneHandler;
-  handler_funcs_[SYS_fork] = &PtraceSyscall::ForkHandler;
-  handler_funcs_[SYS_vfork] = &PtraceSyscall::VForkHandler;
-  handler_funcs_[SYS_execve] = &PtraceSyscall::ExecveHandler;
-  handler_funcs_[SYS_truncate] = &PtraceSyscall::TruncateHandler;
-  handler_funcs_[SYS_getcwd] = &PtraceSyscall::GetcwdHandler;
-  handler_funcs_[SYS_chdir] = &PtraceSyscall::ChdirHandler;
-  handler_funcs_[SYS_rename] = &PtraceSyscall::RenameHandler;
-  handler_funcs_[SYS_mkdir] = &PtraceSyscall::MkdirHandler;
-  handler_funcs_[SYS_rmdir] = &PtraceSyscall::RmdirHandler;
-  handler_funcs_[SYS_creat] = &PtraceSyscall::CreatHandler;
-  handler_funcs_[SYS_link] = &PtraceSyscall::LinkHandler;
-  handler_funcs_[SYS_unlink] = &PtraceSyscall::UnlinkHandler;
-  handler_funcs_[SYS_symlink] = &PtraceSyscall::SymlinkHandler;
-  handler_funcs_[SYS_readlink] = &PtraceSyscall::ReadlinkHandler;
-  handler_funcs_[SYS_chmod] = &PtraceSyscall::ChmodHandler;
-  handler_funcs_[SYS_chown] = &PtraceSyscall::ChownHandler;
-  handler_funcs_[SYS_lchown] = &PtraceSyscall::LChownHandler;
-  handler_funcs_[SYS_kill] = &PtraceSyscall::KillHandler;
-  handler_funcs_[SYS_tkill] = &PtraceSyscall::TkillHandler;
-  handler_funcs_[SYS_tgkill] = &PtraceSyscall::TgkillHandler;
-  handler_funcs_[SYS_rt_sigqueueinfo] = &PtraceSyscall::RtSigqueueinfoHandler;
-  handler_funcs_[SYS_rt_tgsigqueueinfo] =
-      &PtraceSyscall::RtTgsigqueueinfoHandler;
-  handler_funcs_[SYS_openat] = &PtraceSyscall::OpenatHandler;
-}
-
-void PtraceSyscall::ProcessSyscall(int sys_num,
+PtraceSyscall::PtraceSyscall(
+    pid_t child_pid, std::shared_ptr<const CompiledPolicy> policy,
+    std::shared_ptr<const std::unordered_set<std::string>> loader_files,
+    std::shared_ptr<WriteQuota> write_quota)
+    : PtraceSyscall(std::make_shared<PtracePeek>(child_pid), policy,
+                    loader_files, write_quota) {
+  SetProcess(child_pid);
+}
+
+PtraceSyscall::PtraceSyscall(
+    std::shared_ptr<const MemoryReader> memory,
+    std::shared_ptr<const CompiledPolicy> policy,
+    std::shared_ptr<const std::unordered_set<std::string>> loader_files,
+    std::shared_ptr<WriteQuota> write_quota)
+    : policy_(policy),
+      loader_files_(loader_files),
+      write_quota_(write_quota),
+      memory_(memory) {}
+
+void PtraceSyscall::SetPolicy(std::shared_ptr<const CompiledPolicy> policy) {
+  if (policy == policy_) return;
+  policy_ = policy;
+  address_verdicts_.clear();
+}
+
+const std::vector<PtraceSyscall::handler_t> &PtraceSyscall::HandlerFuncs() {
+  // The table is shared by every tracee, so it is only built once
+  static const std::vector<handler_t> handler_funcs = [] {
+    std::vector<handler_t> handler_funcs;
+    handler_funcs.insert(handler_funcs.begin(), NUM_KNOWN_SYSCALLS,
+                         &PtraceSyscall::DefaultHandler);
+    handler_funcs[SYS_open] = &PtraceSyscall::OpenHandler;
+    handler_funcs[SYS_stat] = &PtraceSyscall::StatHandler;
+    handler_funcs[SYS_lstat] = &PtraceSyscall::LStatHandler;
+    handler_funcs[SYS_socket] = &PtraceSyscall::SocketHandler;
+    handler_funcs[SYS_clone] = &PtraceSyscall::CloneHandler;
+    handler_funcs[SYS_fork] = &PtraceSyscall::ForkHandler;
+    handler_funcs[SYS_vfork] = &PtraceSyscall::VForkHandler;
+    handler_funcs[SYS_execve] = &PtraceSyscall::ExecveHandler;
+    handler_funcs[SYS_truncate] = &PtraceSyscall::TruncateHandler;
+    handler_funcs[SYS_getcwd] = &PtraceSyscall::GetcwdHandler;
+    handler_funcs[SYS_chdir] = &PtraceSyscall::ChdirHandler;
+    handler_funcs[SYS_rename] = &PtraceSyscall::RenameHandler;
+    handler_funcs[SYS_mkdir] = &PtraceSyscall::MkdirHandler;
+    handler_funcs[SYS_rmdir] = &PtraceSyscall::RmdirHandler;
+    handler_funcs[SYS_creat] = &PtraceSyscall::CreatHandler;
+    handler_funcs[SYS_link] = &PtraceSyscall::LinkHandler;
+    handler_funcs[SYS_unlink] = &PtraceSyscall::UnlinkHandler;
+    handler_funcs[SYS_symlink] = &PtraceSyscall::SymlinkHandler;
+    handler_funcs[SYS_readlink] = &PtraceSyscall::ReadlinkHandler;
+    handler_funcs[SYS_chmod] = &PtraceSyscall::ChmodHandler;
+    handler_funcs[SYS_chown] = &PtraceSyscall::ChownHandler;
+    handler_funcs[SYS_lchown] = &PtraceSyscall::LChownHandler;
+    handler_funcs[SYS_kill] = &PtraceSyscall::KillHandler;
+    handler_funcs[SYS_tkill] = &PtraceSyscall::TkillHandler;
+    handler_funcs[SYS_tgkill] = &PtraceSyscall::TgkillHandler;
+    handler_funcs[SYS_rt_sigqueueinfo] =
+        &PtraceSyscall::RtSigqueueinfoHandler;
+    handler_funcs[SYS_rt_tgsigqueueinfo] =
+        &PtraceSyscall::RtTgsigqueueinfoHandler;
+    handler_funcs[SYS_openat] = &PtraceSyscall::OpenatHandler;
+    handler_funcs[SYS_socketpair] = &PtraceSyscall::SocketpairHandler;
+    handler_funcs[SYS_connect] = &PtraceSyscall::ConnectHandler;
+    handler_funcs[SYS_bind] = &PtraceSyscall::BindHandler;
+    handler_funcs[SYS_sendto] = &PtraceSyscall::SendtoHandler;
+    handler_funcs[SYS_sendmsg] = &PtraceSyscall::SendmsgHandler;
+    handler_funcs[SYS_sendmmsg] = &PtraceSyscall::SendmmsgHandler;
+    handler_funcs[SYS_close] = &PtraceSyscall::CloseHandler;
+    handler_funcs[SYS_write] = &PtraceSyscall::WriteHandler;
+    handler_funcs[SYS_pwrite64] = &PtraceSyscall::WriteHandler;
+    handler_funcs[SYS_writev] = &PtraceSyscall::WritevHandler;
+    handler_funcs[SYS_pwritev] = &PtraceSyscall::WritevHandler;
+    handler_funcs[SYS_pwritev2] = &PtraceSyscall::WritevHandler;
+    handler_funcs[SYS_sendfile] = &PtraceSyscall::SendfileHandler;
+    handler_funcs[SYS_copy_file_range] = &PtraceSyscall::CopyFileRangeHandler;
+    handler_funcs[SYS_splice] = &PtraceSyscall::SpliceHandler;
+    handler_funcs[SYS_fallocate] = &PtraceSyscall::FallocateHandler;
+    handler_funcs[SYS_dup] = &PtraceSyscall::DupHandler;
+    handler_funcs[SYS_dup2] = &PtraceSyscall::Dup2Handler;
+    handler_funcs[SYS_dup3] = &PtraceSyscall::Dup3Handler;
+    handler_funcs[SYS_fcntl] = &PtraceSyscall::FcntlHandler;
+    return handler_funcs;
+  }();
+  return handler_funcs;
+}
+
+bool PtraceSyscall::ProcessSyscall(int sys_num,
                                    const std::vector<ull_t> &args) {
   INFO << " The program made syscall " << sys_num;
-  (this->*handler_funcs_[sys_num])(args);
+  violation_.clear();
+  fail_errno_ = 0;
+  pending_.kind = PendingWrite::NONE;
+  rewrites_.clear();
+  // Negative numbers are rejected by the kernel itself
+  const std::vector<handler_t> &handler_funcs = HandlerFuncs();
+  if (sys_num < 0) return true;
+  // System calls beyond the table (e.g. openat2, clone3, or x32 ones) are not
+  // checked, so they fail as if the kernel did not know them. The C library
+  // falls back to an older call that is checked.
+  if (static_cast<size_t>(sys_num) >= handler_funcs.size()) {
+    INFO << "The program calls unknown syscall " << sys_num;
+    fail_errno_ = ENOSYS;
+    return true;
+  }
+  (this->*handler_funcs[sys_num])(args);
+  return violation_.empty();
+}
+
+bool PtraceSyscall::RewriteArgs(std::vector<ull_t> *args) const {
+  for (const auto &rewrite : rewrites_) {
+    (*args)[rewrite.first] = rewrite.second;
+  }
+  return !rewrites_.empty();
+}
+
+int PtraceSyscall::ProcessSyscallExit(const PendingWrite &pending,
+                                      long long ret) {
+  // What was counted when the system call was admitted is given back if the
+  // call failed or wrote less
+  switch (pending.kind) {
+    case PendingWrite::OPEN: {
+      if (ret < 0) {
+        if (pending.creating) write_quota_->Returned(pending.root, 0, 1);
+        // The file was removed in the meantime, and would have been created
+        if (pending.no_create && ret == -ENOENT) return EDQUOT;
+        break;
+      }
+      writable_files_[static_cast<int>(ret)] = {pending.root,
+                                                pending.cloexec};
+      // The file that existed may have been replaced by a new one in the
+      // meantime, which is only counted now
+      struct stat st;
+      string fd_path = proc_dir_ + "/fd/" + std::to_string(ret);
+      if (pending.existed && !proc_dir_.empty() &&
+          stat(fd_path.c_str(), &st) == 0 &&
+          (st.st_dev != pending.dev || st.st_ino != pending.ino)) {
+        write_quota_->Created(pending.root);
+      }
+      break;
+    }
+    case PendingWrite::CREATE:
+      if (ret < 0) write_quota_->Returned(pending.root, 0, 1);
+      break;
+    case PendingWrite::WRITE: {
+      size_t written = ret > 0 ? static_cast<size_t>(ret) : 0;
+      if (written < pending.bytes) {
+        write_quota_->Returned(pending.root, pending.bytes - written, 0);
+      }
+      break;
+    }
+    case PendingWrite::ALLOCATE:
+      if (ret != 0) write_quota_->Returned(pending.root, pending.bytes, 0);
+      break;
+    case PendingWrite::DUP:
+      if (ret < 0) {
+        break;
+      } else if (pending.root.empty()) {
+        writable_files_.erase(static_cast<int>(ret));
+      } else {
+        writable_files_[static_cast<int>(ret)] = {pending.root,
+                                                  pending.cloexec};
+      }
+      break;
+    case PendingWrite::NONE:
+      break;
+  }
+  return 0;
+}
+
+void PtraceSyscall::InheritWritableFiles(const PtraceSyscall &parent) {
+  writable_files_.insert(parent.writable_files_.begin(),
+                         parent.writable_files_.end());
+}
+
+void PtraceSyscall::CloseOnExec() {
+  for (auto it = writable_files_.begin(); it != writable_files_.end();) {
+    if (it->second.cloexec) {
+      it = writable_files_.erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
-void PtraceSyscall::KillChild(std::string exit_message) const {
-  REQUIRE(kill(child_pid_, SIGKILL) == 0) << "kill failed: " << strerror(errno);
-  FATAL << exit_message;
+void PtraceSyscall::Deny(std::string message) const {
+  INFO << message;
+  if (violation_.empty()) violation_ = message;
 }
 
-void PtraceSyscall::FileReadPermissionCheck(const string &file) const {
-  if (read_file_detector_.IsAllowed(file) ||
-      read_write_file_detector_.IsAllowed(file)) {
+void PtraceSyscall::FileReadPermissionCheck(const string &name) const {
+  string file = Resolve(name);
+  // Most reads of a short program are the loader reading its libraries. They
+  // are found by an exact lookup instead of walking the rules, as long as the
+  // policy, which may have been reloaded since, still lets libraries be read.
+  if (loader_files_ != nullptr && policy_->policy.read_libraries &&
+      loader_files_->count(file)) {
+    INFO << "The file is read by the dynamic loader";
+  } else if (policy_->read_file_detector.IsAllowed(file) ||
+      policy_->read_write_file_detector.IsAllowed(file)) {
     INFO << "The file is granted read permission";
 
   } else {
-    KillChild("The file is not granted read permission");
+    Deny("The file is not granted read permission");
   }
 }
 
 void PtraceSyscall::FileReadWritePermissionCheck(const string &file) const {
-  if (read_write_file_detector_.IsAllowed(file)) {
+  if (policy_->read_write_file_detector.IsAllowed(Resolve(file))) {
     INFO << "The file is granted read-write permission";
   } else {
-    KillChild("The file is not granted read-write permission");
+    Deny("The file is not granted read-write permission");
+  }
+}
+
+void PtraceSyscall::OpenQuotaCheck(const string &file, ull_t flags,
+                                   int flags_arg) const {
+  if (!violation_.empty() || write_quota_ == nullptr ||
+      !write_quota_->Enabled()) {
+    return;
+  }
+  string root = policy_->read_write_file_detector.Match(Resolve(file));
+  if (root.empty()) return;
+
+  // Opening a file that already exists does not create one. A relative path
+  // is looked up from the working directory of the process. The file may be
+  // replaced before it is opened, which is found out when the call returns.
+  pending_ = PendingWrite();
+  struct stat st;
+  string path = file[0] == '/' || proc_dir_.empty()
+                    ? Resolve(file)
+                    : proc_dir_ + "/cwd/" + file;
+  if ((flags & O_CREAT) && !(flags & O_EXCL) && stat(path.c_str(), &st) == 0) {
+    pending_.existed = true;
+    pending_.dev = st.st_dev;
+    pending_.ino = st.st_ino;
+    // Once no file fits, the call may only open the one that exists
+    if (!write_quota_->AdmitCreate(root).empty() && flags_arg != -1) {
+      rewrites_.push_back({flags_arg, flags & ~O_CREAT});
+      pending_.existed = false;
+      pending_.no_create = true;
+    }
+  } else if (flags & O_CREAT) {
+    string limit = write_quota_->AdmitCreate(root);
+    if (!limit.empty()) {
+      QuotaExceeded(limit);
+      return;
+    }
+    write_quota_->Created(root);
+    pending_.creating = true;
+  }
+  pending_.kind = PendingWrite::OPEN;
+  pending_.root = root;
+  pending_.cloexec = flags & O_CLOEXEC;
+}
+
+void PtraceSyscall::WriteQuotaCheck(int fd, ull_t bytes, int count_arg,
+                                    PendingWrite::Kind kind) const {
+  // Only files opened under a read_write directory are tracked, so writes to
+  // anything else cost one lookup
+  if (write_quota_ == nullptr || writable_files_.empty()) return;
+  auto it = writable_files_.find(fd);
+  if (it == writable_files_.end()) return;
+
+  // Like a filesystem that fills up, a write past the limit is cut short, and
+  // only a write once nothing fits exceeds the limit
+  string limit = write_quota_->AdmitWrite(it->second.root, bytes);
+  size_t left = write_quota_->Remaining(it->second.root);
+  if (!limit.empty() && count_arg != -1 && left != 0) {
+    INFO << "Cutting the write to " << left << " bytes";
+    rewrites_.push_back({count_arg, left});
+    bytes = left;
+  } else if (!limit.empty()) {
+    QuotaExceeded(limit);
+    return;
+  }
+  write_quota_->Wrote(it->second.root, bytes);
+  pending_.kind = kind;
+  pending_.root = it->second.root;
+  pending_.bytes = bytes;
+}
+
+void PtraceSyscall::DupQuotaCheck(int old_fd, bool cloexec) const {
+  if (writable_files_.empty()) return;
+  auto it = writable_files_.find(old_fd);
+  pending_.kind = PendingWrite::DUP;
+  pending_.root = it != writable_files_.end() ? it->second.root : "";
+  pending_.cloexec = cloexec;
+}
+
+void PtraceSyscall::QuotaExceeded(const string &limit) const {
+  if (write_quota_->action() == WriteQuota::FAIL) {
+    INFO << "The program exceeded the write limit " << limit
+         << ", failing the system call";
+    fail_errno_ = EDQUOT;
+  } else {
+    Deny("The program exceeded the write limit " + limit);
+  }
+}
+
+void PtraceSyscall::SocketPermissionCheck(ull_t domain, ull_t type) const {
+  // Rules, if any, replace the all-or-nothing socket flag
+  const SocketDetector &detector = policy_->socket_detector;
+  bool allowed = detector.Empty()
+                     ? policy_->policy.socketable
+                     : detector.IsAllowed(static_cast<int>(domain),
+                                          static_cast<int>(type));
+  if (allowed) {
+    INFO << "The program is granted socket permission.";
+  } else {
+    Deny("The program is not allowed to perform socket operations");
+  }
+}
+
+void PtraceSyscall::AddressPermissionCheck(
+    int fd, ull_t addr, ull_t len, char op,
+    const AddressDetector &detector) const {
+  // Without an allowlist every address is permitted
+  if (detector.Empty()) {
+    INFO << "The address is granted permission";
+    return;
+  }
+
+  // Only the raw bytes are peeked here. The cache lets repeated sends to the
+  // same destination skip decoding and matching the address again.
+  len = std::min<ull_t>(len, sizeof(struct sockaddr_storage));
+  string bytes = memory_->Read(reinterpret_cast<void *>(addr), len);
+  if (len < sizeof(sa_family_t) || bytes.size() != len) {
+    Deny("The program passed a malformed socket address");
+    return;
+  }
+  string key = string(1, op) + bytes;
+  std::unordered_map<string, bool> &verdicts = address_verdicts_[fd];
+  auto it = verdicts.find(key);
+  bool allowed;
+  if (it != verdicts.end()) {
+    allowed = it->second;
+  } else {
+    struct sockaddr_storage storage;
+    memset(&storage, 0, sizeof(storage));
+    memcpy(&storage, key.data() + 1, len);
+    const struct sockaddr *sa =
+        reinterpret_cast<const struct sockaddr *>(&storage);
+
+    // Only inet addresses are subject to the allowlist. Other families (e.g.
+    // unix) are decided by the socket() rules.
+    if (sa->sa_family == AF_INET || sa->sa_family == AF_INET6) {
+      allowed = detector.IsAllowed(sa, len);
+    } else {
+      allowed = true;
+    }
+
+    // Keep the cache bounded for programs sending to many destinations
+    if (verdicts.size() >= 64) verdicts.clear();
+    verdicts.insert({key, allowed});
+  }
+
+  if (allowed) {
+    INFO << "The address is granted permission";
+  } else {
+    Deny(string("The program is not allowed to ") +
+              (op == 'b' ? "bind to" : "send to") + " this address");
   }
 }
 
@@ -85,12 +386,13 @@ void PtraceSyscall::OpenHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
   ull_t rdx = args[RDX];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls open(\"" << file << "\", " << rsi << ", " << rdx
        << ")";
 
   if (rsi & (O_WRONLY | O_RDWR)) {
     FileReadWritePermissionCheck(file);
+    OpenQuotaCheck(file, rsi, RSI);
   } else {
     FileReadPermissionCheck(file);
   }
@@ -99,7 +401,7 @@ void PtraceSyscall::OpenHandler(const std::vector<ull_t> &args) const {
 void PtraceSyscall::StatHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls stat(\"" << file << "\", " << rsi << ")";
   FileReadPermissionCheck(file);
 }
@@ -107,7 +409,7 @@ void PtraceSyscall::StatHandler(const std::vector<ull_t> &args) const {
 void PtraceSyscall::LStatHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls lstat(\"" << file << "\", " << rsi << ")";
   FileReadPermissionCheck(file);
 }
@@ -118,11 +420,17 @@ void PtraceSyscall::SocketHandler(const std::vector<ull_t> &args) const {
   ull_t rdx = args[RDX];
   INFO << "The program calls socket(" << rdi << ", " << rsi << ", " << rdx
        << ")";
-  if (socket_) {
-    INFO << "The program is granted socket permission.";
-  } else {
-    KillChild("The program is not allowed to perform socket operations");
-  }
+  SocketPermissionCheck(rdi, rsi);
+}
+
+void PtraceSyscall::SocketpairHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t rdx = args[RDX];
+  ull_t r10 = args[R10];
+  INFO << "The program calls socketpair(" << rdi << ", " << rsi << ", " << rdx
+       << ", " << r10 << ")";
+  SocketPermissionCheck(rdi, rsi);
 }
 
 void PtraceSyscall::CloneHandler(const std::vector<ull_t> &args) const {
@@ -149,7 +457,7 @@ void PtraceSyscall::ExecveHandler(const std::vector<ull_t> &args) const {
   ull_t rdx = args[RDX];
   std::string file = "";
   if (rdi != 0) {
-    file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+    file = (*memory_)[reinterpret_cast<void *>(rdi)];
   }
   INFO << "The program calls execve(" << file << ", " << rsi << ", " << rdx
        << ")";
@@ -158,7 +466,7 @@ void PtraceSyscall::ExecveHandler(const std::vector<ull_t> &args) const {
 void PtraceSyscall::TruncateHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls truncate(" << file << ", " << rsi << ")";
   FileReadWritePermissionCheck(file);
 }
@@ -173,7 +481,7 @@ void PtraceSyscall::GetcwdHandler(const std::vector<ull_t> &args) const {
 
 void PtraceSyscall::ChdirHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls chdir(" << file << ")";
   FileReadPermissionCheck(file);
 }
@@ -181,8 +489,8 @@ void PtraceSyscall::ChdirHandler(const std::vector<ull_t> &args) const {
 void PtraceSyscall::RenameHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string original_name = ptrace_peek_[reinterpret_cast<void *>(rdi)];
-  std::string new_name = ptrace_peek_[reinterpret_cast<void *>(rsi)];
+  std::string original_name = (*memory_)[reinterpret_cast<void *>(rdi)];
+  std::string new_name = (*memory_)[reinterpret_cast<void *>(rsi)];
   INFO << "The program calls rename(" << original_name << ", " << new_name
        << ")";
   FileReadWritePermissionCheck(original_name);
@@ -192,14 +500,30 @@ void PtraceSyscall::RenameHandler(const std::vector<ull_t> &args) const {
 void PtraceSyscall::MkdirHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string directory_name = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string directory_name = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls mkdir(" << directory_name << ", " << rsi << ")";
   FileReadWritePermissionCheck(directory_name);
+  if (!violation_.empty() || write_quota_ == nullptr ||
+      !write_quota_->Enabled()) {
+    return;
+  }
+
+  // A directory counts as a created file
+  string root =
+      policy_->read_write_file_detector.Match(Resolve(directory_name));
+  string limit = write_quota_->AdmitCreate(root);
+  if (!limit.empty()) {
+    QuotaExceeded(limit);
+  } else {
+    write_quota_->Created(root);
+    pending_.kind = PendingWrite::CREATE;
+    pending_.root = root;
+  }
 }
 
 void PtraceSyscall::RmdirHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
-  std::string directory_name = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string directory_name = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls rmdir(" << directory_name << ")";
   FileReadWritePermissionCheck(directory_name);
 }
@@ -207,16 +531,17 @@ void PtraceSyscall::RmdirHandler(const std::vector<ull_t> &args) const {
 void PtraceSyscall::CreatHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls create(" << file << ", " << rsi << ")";
   FileReadWritePermissionCheck(file);
+  OpenQuotaCheck(file, O_CREAT | O_WRONLY | O_TRUNC, -1);
 }
 
 void PtraceSyscall::LinkHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string original_path = ptrace_peek_[reinterpret_cast<void *>(rdi)];
-  std::string new_path = ptrace_peek_[reinterpret_cast<void *>(rsi)];
+  std::string original_path = (*memory_)[reinterpret_cast<void *>(rdi)];
+  std::string new_path = (*memory_)[reinterpret_cast<void *>(rsi)];
   INFO << "The program calls link(" << original_path << ", " << new_path << ")";
   FileReadWritePermissionCheck(original_path);
   FileReadWritePermissionCheck(new_path);
@@ -224,7 +549,7 @@ void PtraceSyscall::LinkHandler(const std::vector<ull_t> &args) const {
 
 void PtraceSyscall::UnlinkHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
-  std::string original_path = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string original_path = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls unlink(" << original_path << ")";
   FileReadWritePermissionCheck(original_path);
 }
@@ -232,8 +557,8 @@ void PtraceSyscall::UnlinkHandler(const std::vector<ull_t> &args) const {
 void PtraceSyscall::SymlinkHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string path1 = ptrace_peek_[reinterpret_cast<void *>(rdi)];
-  std::string path2 = ptrace_peek_[reinterpret_cast<void *>(rsi)];
+  std::string path1 = (*memory_)[reinterpret_cast<void *>(rdi)];
+  std::string path2 = (*memory_)[reinterpret_cast<void *>(rsi)];
   INFO << "The program calls symlink(" << path1 << ", " << path2 << ")";
   // The symbolic link is linked from path2 to path1
   // Thus, we need write permission in path2 and read permission in path1
@@ -245,7 +570,7 @@ void PtraceSyscall::ReadlinkHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
   ull_t rdx = args[RDX];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls readlink(" << file << ", " << rsi << ", " << rdx
        << ")";
   FileReadPermissionCheck(file);
@@ -254,7 +579,7 @@ void PtraceSyscall::ReadlinkHandler(const std::vector<ull_t> &args) const {
 void PtraceSyscall::ChmodHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls chmod(" << file << ", " << rsi << ")";
   FileReadWritePermissionCheck(file);
 }
@@ -263,7 +588,7 @@ void PtraceSyscall::ChownHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
   ull_t rdx = args[RDX];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls chown(" << file << ", " << rsi << ", " << rdx
        << ")";
   FileReadWritePermissionCheck(file);
@@ -273,7 +598,7 @@ void PtraceSyscall::LChownHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
   ull_t rdx = args[RDX];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rdi)];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rdi)];
   INFO << "The program calls lchown(" << file << ", " << rsi << ", " << rdx
        << ")";
   FileReadWritePermissionCheck(file);
@@ -283,14 +608,14 @@ void PtraceSyscall::KillHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
   INFO << "The program calls kill(" << rdi << ", " << rsi << ")";
-  KillChild("The program is not allowed to send signals");
+  Deny("The program is not allowed to send signals");
 }
 
 void PtraceSyscall::TkillHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
   INFO << "The program calls tkill(" << rdi << ", " << rsi << ")";
-  KillChild("The program is not allowed to send signals");
+  Deny("The program is not allowed to send signals");
 }
 
 void PtraceSyscall::TgkillHandler(const std::vector<ull_t> &args) const {
@@ -299,7 +624,7 @@ void PtraceSyscall::TgkillHandler(const std::vector<ull_t> &args) const {
   ull_t rdx = args[RDX];
   INFO << "The program calls tgkill(" << rdi << ", " << rsi << ", " << rdx
        << ")";
-  KillChild("The program is not allowed to send signals");
+  Deny("The program is not allowed to send signals");
 }
 
 void PtraceSyscall::RtSigqueueinfoHandler(
@@ -309,7 +634,7 @@ void PtraceSyscall::RtSigqueueinfoHandler(
   ull_t rdx = args[RDX];
   INFO << "The program calls rt_sigqueueinfo(" << rdi << ", " << rsi << ", "
        << rdx << ")";
-  KillChild("The program is not allowed to send signals");
+  Deny("The program is not allowed to send signals");
 }
 
 void PtraceSyscall::RtTgsigqueueinfoHandler(
@@ -320,15 +645,227 @@ void PtraceSyscall::RtTgsigqueueinfoHandler(
   ull_t r10 = args[R10];
   INFO << "The program calls rt_tgsigqueueinfo(" << rdi << ", " << rsi << ", "
        << rdx << ", " << r10 << ")";
-  KillChild("The program is not allowed to send signals");
+  Deny("The program is not allowed to send signals");
 }
 
 void PtraceSyscall::OpenatHandler(const std::vector<ull_t> &args) const {
   ull_t rdi = args[RDI];
   ull_t rsi = args[RSI];
   ull_t rdx = args[RDX];
-  std::string file = ptrace_peek_[reinterpret_cast<void *>(rsi)];
-  INFO << "The program calls openat(" << rdi << ", " << file << ", " << rdx
+  ull_t r10 = args[R10];
+  std::string file = (*memory_)[reinterpret_cast<void *>(rsi)];
+  INFO << "The program calls openat(" << static_cast<int>(rdi) << ", \""
+       << file << "\", " << rdx << ", " << r10 << ")";
+
+  // A path that does not depend on the directory fd is checked like open()
+  if (static_cast<int>(rdi) != AT_FDCWD && (file.empty() || file[0] != '/')) {
+    Deny("The program is not allowed to call openat() relative to a "
+         "directory. Use open() instead");
+  } else if (rdx & (O_WRONLY | O_RDWR)) {
+    FileReadWritePermissionCheck(file);
+    OpenQuotaCheck(file, rdx, RDX);
+  } else {
+    FileReadPermissionCheck(file);
+  }
+}
+
+void PtraceSyscall::ConnectHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t rdx = args[RDX];
+  INFO << "The program calls connect(" << rdi << ", " << rsi << ", " << rdx
        << ")";
-  KillChild("The program is not allowed to call openat(). Use open() instead");
+  AddressPermissionCheck(static_cast<int>(rdi), rsi, rdx, 'c',
+                         policy_->connect_detector);
+}
+
+void PtraceSyscall::BindHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t rdx = args[RDX];
+  INFO << "The program calls bind(" << rdi << ", " << rsi << ", " << rdx
+       << ")";
+  AddressPermissionCheck(static_cast<int>(rdi), rsi, rdx, 'b',
+                         policy_->bind_detector);
+}
+
+void PtraceSyscall::SendtoHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t rdx = args[RDX];
+  ull_t r10 = args[R10];
+  ull_t r8 = args[R8];
+  ull_t r9 = args[R9];
+  INFO << "The program calls sendto(" << rdi << ", " << rsi << ", " << rdx
+       << ", " << r10 << ", " << r8 << ", " << r9 << ")";
+  // A connected socket sends without a destination address
+  if (r8 == 0) return;
+  AddressPermissionCheck(static_cast<int>(rdi), r8, r9, 'c',
+                         policy_->connect_detector);
+}
+
+void PtraceSyscall::SendmsgHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t rdx = args[RDX];
+  INFO << "The program calls sendmsg(" << rdi << ", " << rsi << ", " << rdx
+       << ")";
+  if (policy_->connect_detector.Empty()) return;
+
+  // The destination is described by msg_name and msg_namelen of the msghdr
+  string header = memory_->Read(reinterpret_cast<void *>(rsi),
+                                    offsetof(struct msghdr, msg_iov));
+  if (header.size() != offsetof(struct msghdr, msg_iov)) {
+    Deny("The program passed a malformed message header");
+    return;
+  }
+  struct msghdr msg;
+  memcpy(&msg, header.data(), header.size());
+  if (msg.msg_name == NULL) return;
+  AddressPermissionCheck(static_cast<int>(rdi),
+                         reinterpret_cast<ull_t>(msg.msg_name),
+                         msg.msg_namelen, 'c', policy_->connect_detector);
+}
+
+void PtraceSyscall::SendmmsgHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t rdx = args[RDX];
+  INFO << "The program calls sendmmsg(" << rdi << ", " << rsi << ", " << rdx
+       << ")";
+  if (policy_->connect_detector.Empty()) return;
+
+  // Each message has its own destination. The kernel sends at most
+  // UIO_MAXIOV of them.
+  size_t count = std::min<ull_t>(static_cast<unsigned int>(rdx), UIO_MAXIOV);
+  string vector = memory_->Read(reinterpret_cast<void *>(rsi),
+                                count * sizeof(struct mmsghdr));
+  if (vector.size() != count * sizeof(struct mmsghdr)) {
+    Deny("The program passed a malformed message vector");
+    return;
+  }
+  for (size_t i = 0; i < count && violation_.empty(); i++) {
+    struct mmsghdr msg;
+    memcpy(&msg, vector.data() + i * sizeof(msg), sizeof(msg));
+    if (msg.msg_hdr.msg_name == NULL) continue;
+    AddressPermissionCheck(static_cast<int>(rdi),
+                           reinterpret_cast<ull_t>(msg.msg_hdr.msg_name),
+                           msg.msg_hdr.msg_namelen, 'c',
+                           policy_->connect_detector);
+  }
+}
+
+void PtraceSyscall::CloseHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  INFO << "The program calls close(" << rdi << ")";
+  // The fd number may be reused by another socket or file
+  address_verdicts_.erase(static_cast<int>(rdi));
+  writable_files_.erase(static_cast<int>(rdi));
+}
+
+void PtraceSyscall::WriteHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rdx = args[RDX];
+  INFO << "The program writes " << rdx << " bytes into fd "
+       << static_cast<int>(rdi);
+  WriteQuotaCheck(static_cast<int>(rdi), rdx, RDX);
+}
+
+void PtraceSyscall::WritevHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t rdx = args[RDX];
+  INFO << "The program writes " << rdx << " buffers into fd "
+       << static_cast<int>(rdi);
+  if (writable_files_.count(static_cast<int>(rdi)) == 0) return;
+
+  // The bytes to write are the sum of the buffer lengths. A vector the
+  // kernel would reject counts as nothing.
+  ull_t bytes = 0;
+  if (rdx <= IOV_MAX) {
+    string iov = memory_->Read(reinterpret_cast<void *>(rsi),
+                               rdx * sizeof(struct iovec));
+    if (iov.size() == rdx * sizeof(struct iovec)) {
+      for (ull_t i = 0; i < rdx; i++) {
+        struct iovec vec;
+        memcpy(&vec, iov.data() + i * sizeof(vec), sizeof(vec));
+        bytes += vec.iov_len;
+      }
+    }
+  }
+  WriteQuotaCheck(static_cast<int>(rdi), bytes, -1);
+}
+
+void PtraceSyscall::SendfileHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t r10 = args[R10];
+  INFO << "The program calls sendfile(" << static_cast<int>(rdi) << ", "
+       << static_cast<int>(rsi) << ", " << r10 << ")";
+  WriteQuotaCheck(static_cast<int>(rdi), r10, R10);
+}
+
+void PtraceSyscall::CopyFileRangeHandler(
+    const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rdx = args[RDX];
+  ull_t r8 = args[R8];
+  INFO << "The program calls copy_file_range(" << static_cast<int>(rdi)
+       << ", " << static_cast<int>(rdx) << ", " << r8 << ")";
+  WriteQuotaCheck(static_cast<int>(rdx), r8, R8);
+}
+
+void PtraceSyscall::SpliceHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rdx = args[RDX];
+  ull_t r8 = args[R8];
+  INFO << "The program calls splice(" << static_cast<int>(rdi) << ", "
+       << static_cast<int>(rdx) << ", " << r8 << ")";
+  WriteQuotaCheck(static_cast<int>(rdx), r8, R8);
+}
+
+void PtraceSyscall::FallocateHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t r10 = args[R10];
+  INFO << "The program calls fallocate(" << static_cast<int>(rdi) << ", "
+       << rsi << ", " << r10 << ")";
+  // Punching or collapsing a range frees space, which is not given back
+  if (rsi & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_COLLAPSE_RANGE)) return;
+  // A partial allocation makes no sense, so it is not cut
+  WriteQuotaCheck(static_cast<int>(rdi), r10, -1, PendingWrite::ALLOCATE);
+}
+
+void PtraceSyscall::DupHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  INFO << "The program calls dup(" << static_cast<int>(rdi) << ")";
+  DupQuotaCheck(static_cast<int>(rdi), false);
+}
+
+void PtraceSyscall::Dup2Handler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  INFO << "The program calls dup2(" << static_cast<int>(rdi) << ", "
+       << static_cast<int>(rsi) << ")";
+  // The new fd replaces whatever it was before, tracked or not
+  DupQuotaCheck(static_cast<int>(rdi), false);
+}
+
+void PtraceSyscall::Dup3Handler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  ull_t rdx = args[RDX];
+  INFO << "The program calls dup3(" << static_cast<int>(rdi) << ", "
+       << static_cast<int>(rsi) << ", " << rdx << ")";
+  DupQuotaCheck(static_cast<int>(rdi), (rdx & O_CLOEXEC) != 0);
+}
+
+void PtraceSyscall::FcntlHandler(const std::vector<ull_t> &args) const {
+  ull_t rdi = args[RDI];
+  ull_t rsi = args[RSI];
+  INFO << "The program calls fcntl(" << static_cast<int>(rdi) << ", " << rsi
+       << ")";
+  if (rsi == F_DUPFD || rsi == F_DUPFD_CLOEXEC) {
+    DupQuotaCheck(static_cast<int>(rdi), rsi == F_DUPFD_CLOEXEC);
+  }
 }
@@ -4,51 +4,201 @@
 #include <sys/types.h>
 #include <functional>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
-#include "file_detector.hh"
+#include "compiled_policy.hh"
+#include "memory_reader.hh"
 #include "ptrace_peek.hh"
+#include "write_quota.hh"
 
 #define RDI 0
 #define RSI 1
 #define RDX 2
 #define R10 3
 #define R8 4
+#define R9 5
+
+// The number of system calls the sandbox knows. Higher numbers fail with
+// ENOSYS.
+#define NUM_KNOWN_SYSCALLS 335
 
 // This class processes the system calls we intercepted and based on the given
-// permission, decide to either kill the tracee program or let it continue
+// permission, decide to either deny the tracee program or let it continue
 class PtraceSyscall {
   using ull_t = unsigned long long;
   using handler_t =
       void (PtraceSyscall::*)(const std::vector<ull_t>& args) const;
 
  public:
-  PtraceSyscall(pid_t child_pid, std::string read, std::string read_write,
-                bool socketable);
+  // What to account for when a system call returns
+  struct PendingWrite {
+    enum Kind {
+      NONE,    // nothing
+      OPEN,    // a writable file is opened as the returned fd
+      CREATE,  // a directory is created
+      WRITE,     // the returned number of bytes, up to _bytes_, is written
+      ALLOCATE,  // _bytes_ are allocated if the call succeeds
+      DUP        // a tracked fd, or none if _root_ is empty, is duplicated
+    } kind = NONE;
+    std::string root;       // the read_write directory written under
+    bool cloexec = false;   // the returned fd is closed on exec
+    bool creating = false;  // the opened file is counted as created
+    bool existed = false;   // the opened file existed as _dev_ and _ino_
+    bool no_create = false;  // O_CREAT was dropped since no file fits
+    dev_t dev = 0;          // the device of the file that existed
+    ino_t ino = 0;          // the inode of the file that existed
+    size_t bytes = 0;       // the bytes counted for the write
+  };
+
+  // _loader_files_, if given, are files the program may read while the
+  // policy sets read_libraries, checked before its rules. Writes under
+  // read_write directories are counted against _write_quota_, if given, which
+  // may be shared by every process of the program.
+  PtraceSyscall(
+      pid_t child_pid, std::shared_ptr<const CompiledPolicy> policy,
+      std::shared_ptr<const std::unordered_set<std::string>> loader_files =
+          nullptr,
+      std::shared_ptr<WriteQuota> write_quota = nullptr);
+
+  // Check system calls whose arguments point into memory read by _memory_,
+  // e.g. to replay recorded system calls
+  PtraceSyscall(
+      std::shared_ptr<const MemoryReader> memory,
+      std::shared_ptr<const CompiledPolicy> policy,
+      std::shared_ptr<const std::unordered_set<std::string>> loader_files =
+          nullptr,
+      std::shared_ptr<WriteQuota> write_quota = nullptr);
+
+  // Returns the policy system calls are checked against
+  const std::shared_ptr<const CompiledPolicy>& policy() const {
+    return policy_;
+  }
+
+  // Check further system calls against _policy_. Verdicts cached under the
+  // previous policy are dropped.
+  void SetPolicy(std::shared_ptr<const CompiledPolicy> policy);
+
+  // Read the arguments of further system calls through _memory_, e.g. for
+  // the thread of the process that makes them
+  void SetMemory(std::shared_ptr<const MemoryReader> memory) {
+    if (memory != memory_) memory_ = memory;
+  }
+
+  // Look up the files of further system calls as process _pid_ sees them,
+  // e.g. relative to its working directory. Otherwise they are looked up as
+  // the calling process sees them.
+  void SetProcess(pid_t pid) { proc_dir_ = "/proc/" + std::to_string(pid); }
+
+  // Resolve relative file names of further system calls against _dir_, e.g.
+  // the directory a replayed trace was recorded in. Otherwise they are
+  // resolved against the directory the sandbox runs in.
+  void SetWorkingDirectory(const std::string& dir) { work_dir_ = dir; }
 
   // Process the _sys_num_ system call with argument _args_
-  void ProcessSyscall(int sys_num, const std::vector<ull_t>& args);
+  // Returns false if the system call is not allowed. The reason can be read
+  // from Violation().
+  bool ProcessSyscall(int sys_num, const std::vector<ull_t>& args);
+
+  // Returns why the last processed system call is not allowed
+  const std::string& Violation() const { return violation_; }
+
+  // Returns the errno the last processed system call must fail with instead
+  // of being run, or 0 if it may run
+  int FailErrno() const { return fail_errno_; }
+
+  // Change _args_ to the arguments the last processed system call must run
+  // with
+  // Returns false if it runs with its own arguments.
+  bool RewriteArgs(std::vector<ull_t>* args) const;
+
+  // Returns what to account for when the last processed system call returns
+  // Unless its kind is NONE, it has to be passed to ProcessSyscallExit(),
+  // along with the return value.
+  const PendingWrite& Pending() const { return pending_; }
 
-  // Kills the tracee program with error message _exit_message_
-  void KillChild(std::string exit_message) const;
+  // Account for the return value _ret_ of a system call whose Pending() was
+  // _pending_, e.g. the bytes it wrote into a file under a read_write
+  // directory
+  // Several threads may be in system calls at once, so each keeps its own.
+  // Returns the errno the system call has to fail with instead, or 0.
+  int ProcessSyscallExit(const PendingWrite& pending, long long ret);
+
+  // Keep tracking the writable files of _parent_, which this process shares
+  // since it was forked
+  void InheritWritableFiles(const PtraceSyscall& parent);
+
+  // Stop tracking the writable files closed by exec()
+  void CloseOnExec();
 
  private:
+  // Returns the handler functions indexed by system call number
+  static const std::vector<handler_t>& HandlerFuncs();
+
+  // Records that the system call is not allowed because of _message_
+  // Only the first violation of a system call is kept.
+  void Deny(std::string message) const;
+
   // A placeholder handler function for system calls we do not intercept
   void DefaultHandler(const std::vector<ull_t>& args) const {}
 
+  // Returns _file_ resolved against the working directory, if one is set
+  std::string Resolve(const std::string& file) const {
+    if (work_dir_.empty() || file.empty() || file[0] == '/') return file;
+    return work_dir_ + "/" + file;
+  }
+
   // Checks if the sandbox allows the file _file_ to be read
-  // If not, kill the tracee program and reports the error
+  // If not, deny the system call and reports the error
   void FileReadPermissionCheck(const std::string& file) const;
 
   // Checks if the sandbox allows the file _file_ to be read and write
-  // If not, kill the tracee program and reports the error
+  // If not, deny the system call and reports the error
   void FileReadWritePermissionCheck(const std::string& file) const;
 
+  // Checks if the sandbox allows creating a socket of family _domain_ and type
+  // _type_
+  // If not, deny the system call and reports the error
+  void SocketPermissionCheck(ull_t domain, ull_t type) const;
+
+  // Checks if the sandbox allows socket fd _fd_ to use the socket address of
+  // _len_ bytes at _addr_ in tracee's memory, against _detector_
+  // _op_ names the operation in the cache key and error message
+  // If not, deny the system call and reports the error
+  void AddressPermissionCheck(int fd, ull_t addr, ull_t len, char op,
+                              const AddressDetector& detector) const;
+
+  // Checks if the file _file_, opened for writing with _flags_, may be
+  // created under the write limits, and tracks the fd it is opened as
+  // If not, deny or fail the system call. If the flags are given by argument
+  // _flags_arg_ (-1 if none), O_CREAT is dropped once no file fits.
+  void OpenQuotaCheck(const std::string& file, ull_t flags,
+                      int flags_arg) const;
+
+  // Checks if _bytes_ more bytes may be written into fd _fd_ under the write
+  // limits, if the fd is tracked
+  // If the bytes are given by argument _count_arg_ (-1 if none), the count is
+  // cut to what still fits. Otherwise deny or fail the system call. _kind_
+  // tells how the return value is accounted for.
+  void WriteQuotaCheck(int fd, ull_t bytes, int count_arg,
+                       PendingWrite::Kind kind = PendingWrite::WRITE) const;
+
+  // Tracks the fd duplicated from _old_fd_ at the exit of the system call,
+  // closed on exec if _cloexec_
+  void DupQuotaCheck(int old_fd, bool cloexec) const;
+
+  // Deny or fail the system call for exceeding the write limit _limit_
+  void QuotaExceeded(const std::string& limit) const;
+
   // Handlers for intercepted system calls
   void OpenHandler(const std::vector<ull_t>& args) const;
   void StatHandler(const std::vector<ull_t>& args) const;
   void LStatHandler(const std::vector<ull_t>& args) const;
   void SocketHandler(const std::vector<ull_t>& args) const;
+  void SocketpairHandler(const std::vector<ull_t>& args) const;
   void CloneHandler(const std::vector<ull_t>& args) const;
   void ForkHandler(const std::vector<ull_t>& args) const;
   void VForkHandler(const std::vector<ull_t>& args) const;
@@ -73,15 +223,47 @@ class PtraceSyscall {
   void RtSigqueueinfoHandler(const std::vector<ull_t>& args) const;
   void RtTgsigqueueinfoHandler(const std::vector<ull_t>& args) const;
   void OpenatHandler(const std::vector<ull_t>& args) const;
+  void ConnectHandler(const std::vector<ull_t>& args) const;
+  void BindHandler(const std::vector<ull_t>& args) const;
+  void SendtoHandler(const std::vector<ull_t>& args) const;
+  void SendmsgHandler(const std::vector<ull_t>& args) const;
+  void SendmmsgHandler(const std::vector<ull_t>& args) const;
+  void CloseHandler(const std::vector<ull_t>& args) const;
+  void WriteHandler(const std::vector<ull_t>& args) const;
+  void WritevHandler(const std::vector<ull_t>& args) const;
+  void SendfileHandler(const std::vector<ull_t>& args) const;
+  void CopyFileRangeHandler(const std::vector<ull_t>& args) const;
+  void SpliceHandler(const std::vector<ull_t>& args) const;
+  void FallocateHandler(const std::vector<ull_t>& args) const;
+  void DupHandler(const std::vector<ull_t>& args) const;
+  void Dup2Handler(const std::vector<ull_t>& args) const;
+  void Dup3Handler(const std::vector<ull_t>& args) const;
+  void FcntlHandler(const std::vector<ull_t>& args) const;
+
+  // A file opened for writing under a read_write directory
+  struct WritableFile {
+    std::string root;  // the read_write directory it is under
+    bool cloexec;      // it is closed on exec
+  };
 
-  pid_t child_pid_;  // child process's pid
-  FileDetector
-      read_file_detector_;  // a file detector to decide read permission
-  FileDetector read_write_file_detector_;  // a file detector to decide read and
-                                           // write permission
-  bool socket_;                            // able to do socket operation or not
-  std::vector<handler_t> handler_funcs_;   // handler functions
-  PtracePeek ptrace_peek_;  // a helper to peek into tracee's memory
+  std::shared_ptr<const CompiledPolicy> policy_;  // the policy to enforce
+  std::shared_ptr<const std::unordered_set<std::string>>
+      loader_files_;  // files the dynamic loader reads to start the program
+  mutable std::unordered_map<int, std::unordered_map<std::string, bool>>
+      address_verdicts_;  // cached verdicts per socket fd and socket address
+  mutable std::string violation_;  // why the current system call is denied
+  mutable int fail_errno_ = 0;     // errno to fail the current system call with
+  std::shared_ptr<WriteQuota>
+      write_quota_;  // limits on what may be written, if any
+  mutable std::unordered_map<int, WritableFile>
+      writable_files_;  // files counted against the write limits, by fd
+  mutable PendingWrite pending_;  // what the current system call may write
+  mutable std::vector<std::pair<int, ull_t>>
+      rewrites_;  // arguments of the current system call to change, by index
+  std::shared_ptr<const MemoryReader>
+      memory_;  // a helper to peek into tracee's memory
+  std::string proc_dir_;  // /proc directory of the process, if it is known
+  std::string work_dir_;  // directory relative file names are resolved against
 };
 
 #endif  // PTRACE_SYSCALL_HH
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "compiled_policy.hh"
+#include "log.h"
+#include "monotonic_clock.hh"
+#include "policy.hh"
+#include "ptrace_syscall.hh"
+#include "syscall_names.hh"
+#include "syscall_trace.hh"
+
+// Check every system call of _records_ against _policy_ _iterations_ times,
+// storing the verdicts of the first time in _verdicts_ and the time taken in
+// _seconds_
+// The threads of each recorded process share one engine, as they do in the
+// sandbox. Relative file names are resolved against _cwd_, if it is given.
+static void Replay(const std::vector<TraceRecord> &records,
+                   const std::string &cwd,
+                   std::shared_ptr<const CompiledPolicy> policy,
+                   int iterations, std::vector<std::string> *verdicts,
+                   double *seconds) {
+  std::shared_ptr<ReplayPeek> memory = std::make_shared<ReplayPeek>();
+  std::unordered_map<pid_t, PtraceSyscall> engines;
+  std::vector<PtraceSyscall *> record_engines;
+  for (const TraceRecord &record : records) {
+    auto it = engines.find(record.tgid);
+    if (it == engines.end()) {
+      it = engines.emplace(record.tgid, PtraceSyscall(memory, policy)).first;
+      if (!cwd.empty()) it->second.SetWorkingDirectory(cwd);
+    }
+    record_engines.push_back(&it->second);
+  }
+
+  double start = Now();
+  for (int i = 0; i < iterations; i++) {
+    for (size_t j = 0; j < records.size(); j++) {
+      const TraceRecord &record = records[j];
+      PtraceSyscall *engine = record_engines[j];
+      memory->Load(&record);
+      bool allowed = engine->ProcessSyscall(record.sys_num, record.args);
+      if (verdicts != NULL && i == 0) {
+        verdicts->push_back(
+            !allowed ? "deny " + engine->Violation()
+            : engine->FailErrno() != 0
+                ? "fail " + std::to_string(engine->FailErrno())
+                : "allow");
+      }
+    }
+  }
+  *seconds = Now() - start;
+}
+
+// Returns the verdict lines of _verdicts_ for _records_, as written by -o
+static std::vector<std::string> VerdictLines(
+    const std::vector<TraceRecord> &records,
+    const std::vector<std::string> &verdicts) {
+  std::vector<std::string> lines;
+  for (size_t i = 0; i < records.size(); i++) {
+    lines.push_back(std::to_string(i + 1) + " " +
+                    std::to_string(records[i].pid) + " " +
+                    SyscallName(records[i].sys_num) + " " + verdicts[i]);
+  }
+  return lines;
+}
+
+int main(int argc, char **argv) {
+  int threads = 1;
+  int iterations = 1;
+  std::string output_file;
+  std::string compare_file;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:o:c:")) != -1) {
+    switch (opt) {
+      case 't':
+        threads = atoi(optarg);
+        break;
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'c':
+        compare_file = optarg;
+        break;
+      default:
+        exit(1);
+    }
+  }
+  if (argc - optind != 2 || threads < 1 || iterations < 1) {
+    std::cout << "Usage: ./g-sandbox-replay [-t threads] [-n iterations] "
+                 "[-o verdicts] [-c verdicts] config_file trace_file"
+              << std::endl;
+    exit(1);
+  }
+
+  Policy policy;
+  std::string error;
+  REQUIRE(ParseConfig(argv[optind], &policy, &error)) << error;
+  std::shared_ptr<const CompiledPolicy> compiled;
+  error = CheckPolicy(policy, &compiled);
+  REQUIRE(error.empty()) << error;
+
+  std::vector<TraceRecord> records;
+  std::string cwd;
+  REQUIRE(ReadTrace(argv[optind + 1], &records, &cwd, &error)) << error;
+
+  // Every thread replays the whole trace with its own engines, sharing the
+  // compiled policy as the tracees of a sandbox do
+  std::vector<std::string> verdicts;
+  std::vector<double> seconds(threads);
+  std::vector<std::thread> workers;
+  double start = Now();
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back(Replay, std::cref(records), std::cref(cwd), compiled,
+                         iterations, i == 0 ? &verdicts : NULL, &seconds[i]);
+  }
+  for (std::thread &worker : workers) worker.join();
+  double wall_time = Now() - start;
+
+  size_t checks = records.size() * iterations * threads;
+  size_t denied = 0, failed = 0;
+  for (const std::string &verdict : verdicts) {
+    if (verdict.compare(0, 5, "deny ") == 0) denied++;
+    if (verdict.compare(0, 5, "fail ") == 0) failed++;
+  }
+  std::cout << "Replayed " << records.size() << " system calls " << iterations
+            << " times on " << threads << " threads in " << wall_time
+            << " s: " << checks / wall_time << " checks/s, "
+            << seconds[0] * 1e9 / (records.size() * iterations)
+            << " ns per check" << std::endl;
+  std::cout << "Verdicts: " << records.size() - denied - failed
+            << " allowed, " << denied << " denied, " << failed << " failed"
+            << std::endl;
+
+  std::vector<std::string> lines = VerdictLines(records, verdicts);
+  if (!output_file.empty()) {
+    std::ofstream out(output_file);
+    REQUIRE(out) << "Cannot open " << output_file;
+    for (const std::string &line : lines) out << line << "\n";
+  }
+
+  // Verdicts are compared line by line, so a changed verdict shows up with
+  // the system call it belongs to
+  if (!compare_file.empty()) {
+    std::ifstream in(compare_file);
+    REQUIRE(in) << "Cannot open " << compare_file;
+    std::vector<std::string> expected;
+    std::string line;
+    while (getline(in, line)) expected.push_back(line);
+
+    size_t diffs = 0;
+    for (size_t i = 0; i < std::max(lines.size(), expected.size()); i++) {
+      std::string got = i < lines.size() ? lines[i] : "(none)";
+      std::string want = i < expected.size() ? expected[i] : "(none)";
+      if (got == want) continue;
+      if (++diffs <= 20) {
+        std::cout << "- " << want << "\n+ " << got << std::endl;
+      }
+    }
+    std::cout << diffs << " verdicts differ from " << compare_file
+              << std::endl;
+    if (diffs != 0) return 1;
+  }
+  return 0;
+}
@@ -1,70 +1,374 @@
+#include "sandbox.hh"
+
+#include <limits.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/errno.h>
+#include <sys/eventfd.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <unistd.h>
-#include <libconfig.h++>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 
+#include "compiled_policy.hh"
+#include "cpu_affinity.hh"
+#include "fork_limiter.hh"
+#include "library_resolver.hh"
 #include "log.h"
+#include "monotonic_clock.hh"
+#include "output_capture.hh"
 #include "ptrace_syscall.hh"
+#include "syscall_trace.hh"
+#include "trusted_filter.hh"
+#include "write_quota.hh"
 
 #define PTRACE_EXEC_STATUS (SIGTRAP | (PTRACE_EVENT_EXEC << 8))
 #define PTRACE_CLONE_STATUS (SIGTRAP | (PTRACE_EVENT_CLONE << 8))
 #define PTRACE_FORK_STATUS (SIGTRAP | (PTRACE_EVENT_FORK << 8))
 #define PTRACE_VFORK_STATUS (SIGTRAP | (PTRACE_EVENT_VFORK << 8))
+#define PTRACE_SECCOMP_STATUS (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8))
+
+// Bookkeeping shared by the threads of a traced process. Their system calls
+// are checked by one engine, which keeps the fd table, the cached verdicts and
+// the policy of the process.
+struct ThreadGroup {
+  ThreadGroup(
+      pid_t tgid, std::shared_ptr<const CompiledPolicy> policy,
+      std::shared_ptr<const std::unordered_set<std::string>> loader_files,
+      std::shared_ptr<WriteQuota> write_quota)
+      : tgid(tgid),
+        ptrace_syscall(std::shared_ptr<const MemoryReader>(), policy,
+                       loader_files, write_quota),
+        trusted(false),
+        threads(0) {
+    ptrace_syscall.SetProcess(tgid);
+  }
+
+  pid_t tgid;                    // the pid of the process
+  PtraceSyscall ptrace_syscall;  // intercepts the system calls of every thread
+  bool trusted;    // runs a trusted program, so only stops at events
+  size_t threads;  // threads of the process being traced
+};
+
+// Bookkeeping for a traced thread, kept small since a process may have
+// hundreds of them
+struct Tracee {
+  Tracee(std::shared_ptr<ThreadGroup> group,
+         std::shared_ptr<const MemoryReader> memory)
+      : group(group),
+        memory(memory),
+        in_syscall(false),
+        new_thread(true),
+        interrupted(false),
+        fail_errno(0) {}
+
+  std::shared_ptr<ThreadGroup> group;  // the process the thread belongs to
+  std::shared_ptr<const MemoryReader>
+      memory;        // reads the memory of the process through this thread
+  bool in_syscall;   // stopped between the entry and exit of a system call
+  bool new_thread;   // the initial SIGSTOP of the thread is still pending
+  bool interrupted;  // a SIGSTOP sent by the sandbox is still pending
+  int fail_errno;    // errno to return from the current system call, if any
+  PtraceSyscall::PendingWrite
+      pending;  // what the current system call may write
+};
+
+// The processes of a program, which the output capture thread kills as soon
+// as the program writes more than it may, even if they never stop for the
+// tracer. They are held by pidfds, so a process that exited is never mistaken
+// for a new one with the same pid.
+class ProcessTree {
+ public:
+  ProcessTree() : killed_(false) {}
+  ~ProcessTree() {
+    for (const auto &pidfd : pidfds_) close(pidfd.second);
+  }
+
+  // Start holding process _pid_, which has not been waited for yet
+  void Add(pid_t pid) {
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd == -1) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (killed_) syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+    pidfds_[pid] = pidfd;
+  }
+
+  // Stop holding process _pid_ once all its threads have exited
+  void Remove(pid_t pid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pidfds_.find(pid);
+    if (it == pidfds_.end()) return;
+    close(it->second);
+    pidfds_.erase(it);
+  }
+
+  // Kill every process held, and every process added from now on
+  void Kill() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    killed_ = true;
+    for (const auto &pidfd : pidfds_) {
+      syscall(SYS_pidfd_send_signal, pidfd.second, SIGKILL, NULL, 0);
+    }
+  }
 
-using libconfig::Config;
-using libconfig::FileIOException;
-using libconfig::ParseException;
-
-static std::string read_file = "";
-static std::string read_write_file = "";
-static bool forkable = false;
-static bool execable = false;
-static bool socketable = false;
-
-// Parse restrictions flags from configuration file
-void ParseConfig(std::string config_file) {
-  Config cfg;
-
-  // Read the file. If there is an error, report it and exit.
-  try {
-    cfg.readFile(config_file.c_str());
-  } catch (const FileIOException &fioex) {
-    FATAL << "I/O error while reading file.";
-  } catch (const ParseException &pex) {
-    FATAL << "Parse error at " << pex.getFile() << ":" << pex.getLine() << " - "
-          << pex.getError();
-  }
-
-  // Parse variables
-  // If variable name cannot be found, passed in variables witll not be changed
-  cfg.lookupValue("read", read_file);
-  cfg.lookupValue("read_write", read_write_file);
-  cfg.lookupValue("fork", forkable);
-  cfg.lookupValue("exec", execable);
-  cfg.lookupValue("socket", socketable);
+ private:
+  std::mutex mutex_;
+  bool killed_;                              // every process is to be killed
+  std::unordered_map<pid_t, int> pidfds_;  // pidfd of each process, by pid
+};
+
+// Returns the real path of the executable process _pid_ runs, or an empty
+// string if it cannot be read
+static std::string ExecutablePath(pid_t pid) {
+  char path[PATH_MAX];
+  std::string link = "/proc/" + std::to_string(pid) + "/exe";
+  ssize_t len = readlink(link.c_str(), path, sizeof(path));
+  if (len == -1 || len == sizeof(path)) return "";
+  return std::string(path, len);
 }
 
-// Trace a process with child_pid
-void Trace(pid_t child_pid) {
+// Returns the pid of the process thread _tid_ belongs to, or -1 if it cannot
+// be read
+static pid_t ThreadGroupId(pid_t tid) {
+  std::ifstream status("/proc/" + std::to_string(tid) + "/status");
+  std::string line;
+  while (getline(status, line)) {
+    if (line.compare(0, 5, "Tgid:") == 0) return atoi(line.c_str() + 5);
+  }
+  return -1;
+}
+
+// Wait for a tracee of the calling thread to change state, polling for up to
+// _busy_poll_us_ microseconds before blocking
+// Threads other than the first of a process are only reported with __WALL.
+static pid_t WaitForTracee(int *status, int busy_poll_us) {
+  if (busy_poll_us > 0) {
+    double deadline = Now() + busy_poll_us / 1e6;
+    do {
+      pid_t pid = waitpid(-1, status, __WALL | __WNOTHREAD | WNOHANG);
+      if (pid != 0) return pid;
+    } while (Now() < deadline);
+  }
+  return waitpid(-1, status, __WALL | __WNOTHREAD);
+}
+
+Sandbox::Sandbox(const Policy &policy)
+    : policy_(std::make_shared<const CompiledPolicy>(policy)),
+      unfiltered_runs_(0) {}
+
+std::string Sandbox::UpdatePolicy(const Policy &policy) {
+  std::shared_ptr<const CompiledPolicy> compiled;
+  std::string error = CheckPolicy(policy, &compiled);
+  if (!error.empty()) return error;
+  std::lock_guard<std::mutex> lock(runs_mutex_);
+  if (!policy.trusted.empty() && unfiltered_runs_ != 0) {
+    return "Cannot set trusted while a program started without it runs";
+  }
+  std::atomic_store(&policy_, compiled);
+  return "";
+}
+
+SandboxResult Sandbox::Run(const std::vector<std::string> &argv) {
+  SandboxResult result;
+  if (argv.empty()) {
+    result.error = "No program to run";
+    return result;
+  }
+  std::shared_ptr<const CompiledPolicy> compiled = std::atomic_load(&policy_);
+  const Policy &policy = compiled->policy;
+  result.error = CheckPolicy(*compiled);
+  if (!result.error.empty()) return result;
+
+  // Build the arguments before forking, since the child of a multithreaded
+  // process may only call async-signal-safe functions
+  std::vector<char *> program;
+  for (const auto &arg : argv) {
+    program.push_back(const_cast<char *>(arg.c_str()));
+  }
+  program.push_back(NULL);
+
+  // Capture the output of the program in files, moved there by a thread of
+  // its own, since the tracer may be blocked waiting for the program while
+  // the program is blocked on a full pipe
+  std::unique_ptr<OutputCapture> captures[2];
+  const std::string *capture_files[2] = {&policy.stdout_file,
+                                         &policy.stderr_file};
+  for (int i = 0; i < 2; i++) {
+    if (capture_files[i]->empty()) continue;
+    captures[i].reset(new OutputCapture(*capture_files[i],
+                                        policy.output_limit));
+    if (!captures[i]->Error().empty()) {
+      result.error = captures[i]->Error();
+      return result;
+    }
+  }
+
+  // Put the tracer and the program on the same CPUs, so every stop is a
+  // wakeup between nearby cores. The program's processes inherit the
+  // affinity of this thread, which is restored when the run is over.
+  cpu_set_t host_cpus;
+  bool pinned = false;
+  if (policy.affinity != "none") {
+    cpu_set_t cpus;
+    bool found = policy.affinity == "node" ? CurrentNodeCpus(&cpus)
+                                           : ParseCpuList(policy.cpus, &cpus);
+    if (!found || sched_getaffinity(0, sizeof(host_cpus), &host_cpus) == -1) {
+      result.error = "Cannot set the CPU affinity";
+      return result;
+    }
+
+    // The node may have CPUs the sandbox itself is not allowed on, e.g. by
+    // taskset or a cpuset, which the program must not escape to
+    if (policy.affinity == "node") {
+      CPU_AND(&cpus, &cpus, &host_cpus);
+      if (CPU_COUNT(&cpus) == 0) {
+        result.error =
+            "No CPU of the current NUMA node is in the affinity of the sandbox";
+        return result;
+      }
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+      result.error = "Cannot set the CPU affinity";
+      return result;
+    }
+    pinned = true;
+  }
+
+  // Resolve what the dynamic loader will read before the program starts, so
+  // its reads are found in one lookup
+  std::shared_ptr<const std::unordered_set<std::string>> loader_files;
+  if (policy.read_libraries) {
+    loader_files = std::make_shared<const std::unordered_set<std::string>>(
+        ResolveLoaderFiles(argv[0]));
+  }
+
+  // Trusted programs run without stopping at each system call, so the few
+  // calls they are still checked for are stopped in the kernel. The policy
+  // may have been replaced since it was loaded, so the current one decides
+  // too. Without the filter no program may be trusted until the run is over.
+  std::vector<struct sock_filter> filter;
+  {
+    std::lock_guard<std::mutex> lock(runs_mutex_);
+    if (!policy.trusted.empty() ||
+        !std::atomic_load(&policy_)->policy.trusted.empty()) {
+      filter = TrustedFilter();
+    } else {
+      unfiltered_runs_++;
+    }
+  }
+
+  double start = Now();
+
+  // Call fork to create a child process
+  pid_t child_pid = fork();
+  if (child_pid == -1) {
+    result.error = std::string("fork failed: ") + strerror(errno);
+  } else if (child_pid == 0) {
+    // If this is the child, ask to be traced
+    if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) _exit(127);
+
+    // Do not pass on signals blocked by the host, e.g. to wait for SIGHUP
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    for (int i = 0; i < 2; i++) {
+      if (captures[i] && dup2(captures[i]->WriteEnd(), i + 1) == -1) {
+        _exit(127);
+      }
+    }
+
+    // Stop the process so the tracer can catch it
+    raise(SIGSTOP);
+
+    if (!filter.empty() && !InstallFilter(&filter)) _exit(127);
+    execvp(program[0], program.data());
+    _exit(127);
+  } else {
+    // Only the program keeps the pipes open, so they are closed once all its
+    // processes have exited
+    std::vector<OutputCapture *> capturing;
+    for (int i = 0; i < 2; i++) {
+      if (!captures[i]) continue;
+      captures[i]->CloseWriteEnd();
+      capturing.push_back(captures[i].get());
+    }
+    // The program is killed by the capture thread when it writes more than
+    // it may, since a trusted or blocked program may not stop for a long time
+    bool kill_on_overflow = policy.output_limit_action == "kill";
+    std::atomic<bool> output_overflow(false);
+    ProcessTree processes;
+    int stop_capture = -1;
+    std::thread capture_thread;
+    if (!capturing.empty()) {
+      stop_capture = eventfd(0, EFD_CLOEXEC);
+      capture_thread = std::thread(CaptureOutput, capturing, stop_capture, [&] {
+        output_overflow = true;
+        if (kill_on_overflow) processes.Kill();
+      });
+    }
+
+    // Wait for the child to stop. Only children of this thread are waited
+    // for, so sandboxes on other threads keep their own processes.
+    int status;
+    do {
+      if (waitpid(child_pid, &status, __WNOTHREAD) != child_pid) {
+        result.error = std::string("waitpid failed: ") + strerror(errno);
+        kill(child_pid, SIGKILL);
+        break;
+      }
+    } while (!WIFSTOPPED(status));
+
+    if (result.error.empty()) {
+      Trace(child_pid, loader_files,
+            kill_on_overflow ? &output_overflow : NULL,
+            kill_on_overflow && !capturing.empty() ? &processes : NULL,
+            &result);
+    }
+    result.stats.wall_time = Now() - start;
+
+    if (capture_thread.joinable()) {
+      eventfd_write(stop_capture, 1);
+      capture_thread.join();
+      close(stop_capture);
+    }
+    if (captures[0]) result.stats.stdout_bytes = captures[0]->Captured();
+    if (captures[1]) result.stats.stderr_bytes = captures[1]->Captured();
+    for (int i = 0; i < 2; i++) {
+      if (captures[i]) result.stats.dropped_bytes += captures[i]->Dropped();
+    }
+  }
+
+  if (filter.empty()) {
+    std::lock_guard<std::mutex> lock(runs_mutex_);
+    unfiltered_runs_--;
+  }
+  if (pinned) sched_setaffinity(0, sizeof(host_cpus), &host_cpus);
+  return result;
+}
+
+void Sandbox::Trace(
+    pid_t child_pid,
+    std::shared_ptr<const std::unordered_set<std::string>> loader_files,
+    const std::atomic<bool> *output_overflow, ProcessTree *processes,
+    SandboxResult *result) {
   // Keep track of what's the last signal intercepted
   int last_signal = 0;
 
   // child status from waitpid
   int status;
 
-  // Keep track of total run times to aovid duplicated system call signal
-  size_t total_times = 0;
-
-  // Keep track of how many tracess processes are running
-  size_t total_process_running = 1;
-
   // The pid of the current child process that is stopped by the tracer
   pid_t cur_child_pid = child_pid;
 
@@ -74,48 +378,319 @@ void Trace(pid_t child_pid) {
   // A flag to check if the previous run has a quited tracee
   bool process_quit = false;
 
-  // A lookup table to eastablish mapping between tracee process pid and its
-  // index in ptrace_syscalls
-  std::unordered_map<pid_t, int> ptrace_syscall_lookup_table = {{child_pid, 0}};
+  // The tracee handled in the last stop, if it is still traced
+  Tracee *stopped = NULL;
 
-  // A vector of PtraceSyscall libraries that are used to intecept system calls
-  std::vector<PtraceSyscall> ptrace_syscalls;
-  ptrace_syscalls.emplace_back(child_pid, read_file, read_write_file,
-                               socketable);
+  // The policy stops are handled under. It is reloaded at the start of every
+  // stop.
+  std::shared_ptr<const CompiledPolicy> policy = std::atomic_load(&policy_);
 
-  // Set options for ptrace to stop at exec(), clone(), fork(), and vfork()
-  REQUIRE(ptrace(PTRACE_SETOPTIONS, child_pid, NULL,
-                 PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK | PTRACE_O_TRACECLONE |
-                     PTRACE_O_TRACEVFORK) != -1)
-      << "ptrace PTRACE_SETOPTIONS failed: " << strerror(errno);
+  // Records every checked system call if recording is enabled
+  std::unique_ptr<SyscallRecorder> recorder;
+  if (!policy->policy.record.empty()) {
+    recorder.reset(new SyscallRecorder(policy->policy.record));
+  }
+
+  // What every tracee has written under the read_write directories
+  std::shared_ptr<WriteQuota> write_quota =
+      std::make_shared<WriteQuota>(policy->policy);
+
+  // Every running thread by tid. Entries are removed when a thread exits, so
+  // lookups and memory stay constant no matter how many processes were forked.
+  std::unordered_map<pid_t, Tracee> tracees;
+
+  // Number of processes with a running thread
+  size_t live_processes = 0;
+
+  // Start tracing thread _tid_ of the process of _group_, or of a new process
+  // if _group_ is null. Its memory reads are recorded along with its system
+  // calls. Returns its entry in tracees.
+  auto add_thread = [&](pid_t tid, std::shared_ptr<ThreadGroup> group) {
+    if (!group) {
+      group = std::make_shared<ThreadGroup>(tid, policy, loader_files,
+                                            write_quota);
+      live_processes++;
+      if (processes) processes->Add(tid);
+    }
+    group->threads++;
+    std::shared_ptr<const MemoryReader> memory;
+    if (recorder) {
+      memory = std::make_shared<RecordingPeek>(tid, recorder->peeks());
+    } else {
+      memory = std::make_shared<PtracePeek>(tid);
+    }
+    auto it = tracees.emplace(tid, Tracee(group, memory)).first;
+    result->stats.peak_threads =
+        std::max(result->stats.peak_threads, tracees.size());
+    return it;
+  };
+
+  // Stop tracing the thread of entry _it_ in tracees
+  auto remove_thread = [&](std::unordered_map<pid_t, Tracee>::iterator it) {
+    if (--it->second.group->threads == 0) {
+      live_processes--;
+      if (processes) processes->Remove(it->second.group->tgid);
+    }
+    tracees.erase(it);
+  };
+
+  add_thread(child_pid, nullptr)->second.new_thread = false;
+  result->stats.peak_processes = 1;
+
+  // Processes whose fork was failed by a limit. They are killed and never
+  // resumed.
+  std::unordered_set<pid_t> discarded;
+
+  // New threads and processes that stopped before their creator reported
+  // them. They are left stopped until then, so none runs before it is known
+  // to be trusted, to share writable files or to fit the fork limits.
+  std::unordered_set<pid_t> unreported;
+
+  // Limits on the number of processes the tracees may create
+  ForkLimiter fork_limiter(policy->policy);
+
+  // Polling only pays off if a tracee can run while the tracer spins
+  cpu_set_t tracer_cpus;
+  bool can_poll =
+      sched_getaffinity(0, sizeof(tracer_cpus), &tracer_cpus) == 0 &&
+      CPU_COUNT(&tracer_cpus) > 1;
+
+  // Once set, every tracee is killed and the loop only reaps them
+  bool killing = false;
+
+  // Kill every tracee
+  auto kill_all = [&]() {
+    killing = true;
+    for (const auto &tracee : tracees) kill(tracee.first, SIGKILL);
+    for (pid_t pid : unreported) kill(pid, SIGKILL);
+  };
+
+  // Record that process _pid_ violated the policy and kill every tracee
+  auto violate = [&](pid_t pid, const std::string &message) {
+    if (result->violation.empty()) {
+      result->violation = message;
+      result->violating_pid = pid;
+    }
+    kill_all();
+  };
+
+  // Record a failure of the tracer itself and kill every tracee
+  auto fail = [&](const std::string &message) {
+    if (result->error.empty()) {
+      result->error = message + ": " + strerror(errno);
+    }
+    kill_all();
+  };
+
+  // Check system call _sys_num_ of _tracee_ _pid_ with arguments _args_,
+  // killing every tracee if it is not allowed
+  auto check_syscall = [&](pid_t pid, Tracee &tracee, long sys_num,
+                           const std::vector<unsigned long long> &args) {
+    result->stats.syscalls++;
+    PtraceSyscall &ptrace_syscall = tracee.group->ptrace_syscall;
+    bool allowed = ptrace_syscall.ProcessSyscall(sys_num, args);
+    if (recorder) {
+      recorder->Record(pid, tracee.group->tgid, sys_num, args);
+    }
+    if (!allowed) violate(pid, ptrace_syscall.Violation());
+    return allowed;
+  };
+
+  if (recorder && !recorder->Error().empty()) {
+    result->error = recorder->Error();
+    kill_all();
+  }
+
+  // Times every system call if profiling is enabled
+  std::unique_ptr<SyscallProfiler> profiler;
+  if (policy->policy.profile || !policy->policy.profile_trace.empty()) {
+    profiler.reset(new SyscallProfiler(policy->policy.profile_trace));
+    if (!profiler->Error().empty()) {
+      result->error = profiler->Error();
+      kill_all();
+    }
+  }
+
+  // Resume the new thread of entry _it_, held at its first stop until its
+  // creator reported it
+  auto resume_new = [&](std::unordered_map<pid_t, Tracee>::iterator it) {
+    it->second.new_thread = false;
+    enum __ptrace_request request =
+        it->second.group->trusted ? PTRACE_CONT : PTRACE_SYSCALL;
+    if (ptrace(request, it->first, NULL, 0) == -1) {
+      if (errno != ESRCH) fail("ptrace failed to resume a new tracee");
+    } else if (profiler) {
+      profiler->Resumed(it->first);
+    }
+  };
+
+  // Set options for ptrace to stop at exec(), clone(), fork(), vfork() and
+  // system calls stopped by a seccomp filter, and to kill every tracee if the
+  // tracer dies
+  if (ptrace(PTRACE_SETOPTIONS, child_pid, NULL,
+             PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK | PTRACE_O_TRACECLONE |
+                 PTRACE_O_TRACEVFORK | PTRACE_O_TRACESECCOMP |
+                 PTRACE_O_EXITKILL) == -1) {
+    fail("ptrace PTRACE_SETOPTIONS failed");
+  }
 
   // If there is at least tracee running, keep looping
-  while (total_process_running) {
+  while (!tracees.empty() || !unreported.empty()) {
     // Continue the process, delivering the last signal we received (if any)
+    // A tracee may have been killed in the meantime (ESRCH)
     if (!process_quit) {
-      REQUIRE(ptrace(PTRACE_SYSCALL, cur_child_pid, NULL, last_signal) != -1)
-          << "ptrace PTRACE_SYSCALL failed: " << strerror(errno);
+      // A trusted process only stops at events, unless the system call it is
+      // in has to be failed when it returns
+      if (stopped != NULL && stopped->group->trusted &&
+          stopped->fail_errno == 0) {
+        stopped->in_syscall = false;
+        if (ptrace(PTRACE_CONT, cur_child_pid, NULL, last_signal) == -1) {
+          if (errno != ESRCH) fail("ptrace PTRACE_CONT failed");
+        } else if (profiler) {
+          profiler->Resumed(cur_child_pid);
+        }
+      } else if (ptrace(PTRACE_SYSCALL, cur_child_pid, NULL, last_signal) ==
+                 -1) {
+        if (errno != ESRCH) fail("ptrace PTRACE_SYSCALL failed");
+      } else if (profiler) {
+        profiler->Resumed(cur_child_pid);
+      }
     }
     process_quit = false;
+    stopped = NULL;
 
     // No signal to send yet
     last_signal = 0;
 
     // Wait for the child to stop again
-    REQUIRE((cur_child_pid = waitpid(-1, &status, 0)) != -1)
-        << "waitpid failed: " << strerror(errno);
+    if ((cur_child_pid = WaitForTracee(
+             &status, can_poll ? policy->policy.busy_poll_us : 0)) == -1) {
+      if (errno == EINTR) {
+        process_quit = true;
+        continue;
+      }
+      fail("waitpid failed");
+      break;
+    }
+    if (profiler) profiler->MarkStop();
+
+    // The program wrote more output than it may, so it is being killed by
+    // the capture thread. Like after any violation, the stop is not handled
+    // any further unless the tracee exited.
+    if (output_overflow != NULL && *output_overflow && !killing) {
+      violate(child_pid, "The program exceeded the output limit");
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (WIFEXITED(status)) {
+        INFO << "Child exited with status " << WEXITSTATUS(status);
+      } else {
+        INFO << "Child terminated with signal" << WTERMSIG(status);
+      }
+
+      // The first process decides the outcome of the program
+      if (cur_child_pid == child_pid) {
+        result->exited = WIFEXITED(status);
+        result->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 0;
+        result->term_signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+        if (!done_first_exec && result->error.empty()) {
+          result->error = "Failed to execute the program";
+        }
+      }
+      auto exited = tracees.find(cur_child_pid);
+      if (exited != tracees.end()) remove_thread(exited);
+      discarded.erase(cur_child_pid);
+      unreported.erase(cur_child_pid);
+      // Without any tracee left, no creator will report the waiting ones
+      if (tracees.empty()) {
+        for (pid_t pid : unreported) kill(pid, SIGKILL);
+      }
+      if (profiler) profiler->Exited(cur_child_pid);
+      process_quit = true;
+      continue;
+    }
 
-    if (WIFEXITED(status)) {
-      INFO << "Child exited with status " << WEXITSTATUS(status);
-      total_process_running--;
+    if (killing || discarded.count(cur_child_pid) != 0) {
+      // The process is about to die from SIGKILL, e.g. after a violation
+      kill(cur_child_pid, SIGKILL);
       process_quit = true;
-    } else if (WIFSIGNALED(status)) {
-      INFO << "Child terminated with signal" << WTERMSIG(status);
-      total_process_running--;
+      continue;
+    }
+
+    // Pick up a policy swapped in by UpdatePolicy(). The rest of this stop is
+    // handled under the policy loaded here.
+    std::shared_ptr<const CompiledPolicy> current = std::atomic_load(&policy_);
+    if (current != policy) {
+      INFO << "Switching to the updated policy";
+      policy = current;
+      fork_limiter.Update(policy->policy);
+      write_quota->Update(policy->policy);
+
+      // A process whose program is no longer trusted is checked again. Its
+      // other threads were resumed until their next event, so each one is
+      // stopped by a SIGSTOP that is not delivered, and then resumed to stop
+      // at every system call. A new thread is resumed that way at its first
+      // stop anyway.
+      std::unordered_set<ThreadGroup *> demoted;
+      for (auto &entry : tracees) {
+        ThreadGroup *group = entry.second.group.get();
+        if (group->trusted &&
+            (policy->trusted_detector.Empty() ||
+             !policy->trusted_detector.IsAllowed(
+                 ExecutablePath(group->tgid)))) {
+          INFO << "Process " << group->tgid << " is no longer trusted";
+          group->trusted = false;
+          demoted.insert(group);
+        }
+      }
+      for (auto &entry : tracees) {
+        Tracee &other = entry.second;
+        if (demoted.count(other.group.get()) != 0 &&
+            entry.first != cur_child_pid && !other.new_thread &&
+            syscall(SYS_tgkill, other.group->tgid, entry.first, SIGSTOP) == 0) {
+          other.interrupted = true;
+        }
+      }
+    }
+
+    // A new thread or process may report its first stop before its creator
+    // reports the clone event. It waits for it without being resumed.
+    auto it = tracees.find(cur_child_pid);
+    if (it == tracees.end()) {
+      unreported.insert(cur_child_pid);
       process_quit = true;
-    } else if (status >> 8 == PTRACE_EXEC_STATUS) {
+      continue;
+    }
+    Tracee &tracee = it->second;
+    ThreadGroup &group = *tracee.group;
+    group.ptrace_syscall.SetPolicy(policy);
+    group.ptrace_syscall.SetMemory(tracee.memory);
+    stopped = &tracee;
+
+    if (status >> 8 == PTRACE_EXEC_STATUS) {
       // The program just runs execv
 
+      // Every other thread of the process is gone. A thread other than the
+      // first one that calls exec takes over the pid of the process, and
+      // reports the tid it had in the event.
+      unsigned long former_tid;
+      if (ptrace(PTRACE_GETEVENTMSG, cur_child_pid, NULL, &former_tid) == 0 &&
+          static_cast<pid_t>(former_tid) != cur_child_pid) {
+        auto former = tracees.find(former_tid);
+        if (former != tracees.end()) remove_thread(former);
+        tracee.fail_errno = 0;
+        tracee.pending = PtraceSyscall::PendingWrite();
+      }
+
+      // A trusted program only stops at events from now on. Any other program
+      // stops at every system call, starting with the exit of execve.
+      group.trusted =
+          !policy->trusted_detector.Empty() &&
+          policy->trusted_detector.IsAllowed(ExecutablePath(cur_child_pid));
+      tracee.in_syscall = true;
+      group.ptrace_syscall.CloseOnExec();
+      if (group.trusted) INFO << "Running a trusted program";
+
       // If the tracee hasn't run the first exec that execs the actual program
       // yet
       if (!done_first_exec) {
@@ -124,65 +699,194 @@ void Trace(pid_t child_pid) {
         continue;
       }
 
-      if (execable) {
+      if (policy->policy.execable) {
+        result->stats.execs++;
         last_signal = 0;
       } else {
-        ptrace_syscalls[ptrace_syscall_lookup_table[cur_child_pid]].KillChild(
-            "The program is not allowed to exec");
+        violate(cur_child_pid, "The program is not allowed to exec");
+        process_quit = true;
       }
     } else if (status >> 8 == PTRACE_FORK_STATUS ||
                status >> 8 == PTRACE_CLONE_STATUS ||
                status >> 8 == PTRACE_VFORK_STATUS) {
       // The program just called clone
 
-      if (forkable) {
-        pid_t new_child_pid;
-
-        // Get the new process id forked by tracee
-        REQUIRE(ptrace(PTRACE_GETEVENTMSG, cur_child_pid, NULL,
-                       reinterpret_cast<void *>(&new_child_pid)) != -1)
-            << "ptrace PTRACE_GETEVENTMSG failed: " << strerror(errno);
-
-        // Update our book keeping data structures
-        ptrace_syscall_lookup_table.insert(
-            {new_child_pid, ptrace_syscalls.size()});
-        ptrace_syscalls.emplace_back(new_child_pid, read_file, read_write_file,
-                                     socketable);
-
-        // Set options for ptrace to stop at exec(), clone(), fork(), and
-        // vfork()
-        REQUIRE(ptrace(PTRACE_SETOPTIONS, cur_child_pid, NULL,
-                       PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK |
-                           PTRACE_O_TRACECLONE | PTRACE_O_TRACEVFORK) != -1)
-            << "ptrace PTRACE_SETOPTIONS failed: " << strerror(errno);
-        total_process_running++;
-        last_signal = 0;
+      // Get the new thread id created by tracee
+      unsigned long new_tid;
+      if (ptrace(PTRACE_GETEVENTMSG, cur_child_pid, NULL, &new_tid) == -1) {
+        fail("ptrace PTRACE_GETEVENTMSG failed");
+        process_quit = true;
+        continue;
+      }
+      pid_t new_child_pid = static_cast<pid_t>(new_tid);
+
+      // A new thread joins the process of its creator. It is neither a fork
+      // nor a new process, so it needs no fork permission and is not limited.
+      // clone is told to create a thread by CLONE_THREAD. clone3 passes its
+      // flags in memory, so its child is looked up in /proc instead, and
+      // taken to be a thread of its creator if it cannot be read.
+      bool is_thread = false;
+      if (status >> 8 == PTRACE_CLONE_STATUS) {
+        struct user_regs_struct regs;
+        if (ptrace(PTRACE_GETREGS, cur_child_pid, NULL, &regs) == -1) {
+          if (errno != ESRCH) fail("ptrace PTRACE_GETREGS failed");
+          process_quit = true;
+          continue;
+        }
+        if (regs.orig_rax == SYS_clone) {
+          is_thread = (regs.rdi & CLONE_THREAD) != 0;
+        } else {
+          pid_t tgid = ThreadGroupId(new_child_pid);
+          is_thread = tgid == -1 || tgid == group.tgid;
+        }
+      }
+      tracee.in_syscall = true;
+      last_signal = 0;
+
+      // The new thread or process may have stopped already, waiting to be
+      // resumed once it is set up
+      auto child = tracees.find(new_child_pid);
+      if (is_thread) {
+        if (child == tracees.end()) {
+          child = add_thread(new_child_pid, tracee.group);
+        }
+        result->stats.threads++;
+        if (unreported.erase(new_child_pid) != 0) resume_new(child);
+        continue;
+      }
+
+      if (!policy->policy.forkable) {
+        violate(cur_child_pid, "The program is not allowed to fork");
+        process_quit = true;
+        continue;
+      }
+
+      // Update our book keeping data structures. A child of a trusted
+      // process is trusted as well, it shares the files of its parent, and
+      // the parent is still in the system call when it returns.
+      if (child == tracees.end()) child = add_thread(new_child_pid, nullptr);
+      ThreadGroup &child_group = *child->second.group;
+      child_group.trusted = group.trusted;
+      child_group.ptrace_syscall.InheritWritableFiles(group.ptrace_syscall);
+
+      ForkLimiter::Action action;
+      std::string limit = fork_limiter.Admit(live_processes, &action);
+      if (limit.empty()) {
+        result->stats.forks++;
+        result->stats.peak_processes =
+            std::max(result->stats.peak_processes, live_processes);
+        if (unreported.erase(new_child_pid) != 0) resume_new(child);
+      } else if (action == ForkLimiter::KILL) {
+        violate(cur_child_pid, "The program exceeded the fork limit " + limit);
+        process_quit = true;
+        continue;
       } else {
-        ptrace_syscalls[ptrace_syscall_lookup_table[cur_child_pid]].KillChild(
-            "The program is not allowed to fork");
+        // Fail softly: kill the new process and make the fork return EAGAIN
+        // when the parent leaves the system call
+        INFO << "The program exceeded the fork limit " << limit
+             << ", failing the fork";
+        kill(new_child_pid, SIGKILL);
+        remove_thread(child);
+        discarded.insert(new_child_pid);
+        tracee.fail_errno = EAGAIN;
+      }
+    } else if (status >> 8 == PTRACE_SECCOMP_STATUS) {
+      // The seccomp filter stopped one of the system calls a trusted program
+      // is still checked for. Other programs have already been checked at the
+      // entry of the system call.
+      last_signal = 0;
+      if (!group.trusted) continue;
+
+      unsigned long data;
+      struct user_regs_struct regs;
+      if (ptrace(PTRACE_GETEVENTMSG, cur_child_pid, NULL, &data) == -1 ||
+          ptrace(PTRACE_GETREGS, cur_child_pid, NULL, &regs) == -1) {
+        if (errno != ESRCH) fail("ptrace failed at a seccomp stop");
+        process_quit = true;
+        continue;
+      }
+
+      std::vector<unsigned long long> args = {regs.rdi, regs.rsi, regs.rdx,
+                                              regs.r10, regs.r8,  regs.r9};
+      if (data == TRUSTED_FILTER_FOREIGN) {
+        violate(cur_child_pid,
+                "The program is not allowed to make 32-bit system calls");
+        process_quit = true;
+      } else if (!check_syscall(cur_child_pid, tracee, regs.orig_rax, args)) {
+        process_quit = true;
+      } else if (group.ptrace_syscall.FailErrno() != 0) {
+        // Skip the system call, and stop at its exit to fail it
+        tracee.fail_errno = group.ptrace_syscall.FailErrno();
+        tracee.in_syscall = true;
+        regs.orig_rax = -1;
+        if (ptrace(PTRACE_SETREGS, cur_child_pid, NULL, &regs) == -1 &&
+            errno != ESRCH) {
+          fail("ptrace PTRACE_SETREGS failed");
+        }
       }
     } else if (WIFSTOPPED(status)) {
       // Get the signal delivered to the child
       last_signal = WSTOPSIG(status);
 
+      // A new process starts with a SIGSTOP that should not be delivered
+      if (last_signal == SIGSTOP && tracee.new_thread) {
+        tracee.new_thread = false;
+        last_signal = 0;
+        continue;
+      }
+
+      // Nor should the SIGSTOP that stopped a process no longer trusted
+      if (last_signal == SIGSTOP && tracee.interrupted) {
+        tracee.interrupted = false;
+        last_signal = 0;
+        continue;
+      }
+
       // If the signal was a SIGTRAP, we stopped because of a system call
       if (last_signal == SIGTRAP) {
         // We do not want to send SIGTRAP again to the tracee
         last_signal = 0;
 
+        // A trusted process is only resumed to a system call stop when the
+        // call is to be failed. Any other stop is resumed without a check.
+        if (group.trusted && tracee.fail_errno == 0) continue;
+
         // Keep track of we are before the syscall or after the syscall
-        // In order to avoid over flow, we mod 2
-        total_times = (total_times + 1) % 2;
+        tracee.in_syscall = !tracee.in_syscall;
+
+        // Read register state from the child process
+        struct user_regs_struct regs;
+        if (ptrace(PTRACE_GETREGS, cur_child_pid, NULL, &regs) == -1) {
+          if (errno != ESRCH) fail("ptrace PTRACE_GETREGS failed");
+          process_quit = true;
+          continue;
+        }
 
         // This is the second time we see this system call (after the execution)
-        // We ignore it
-        if (total_times % 2 == 0) {
+        if (!tracee.in_syscall) {
+          if (profiler) {
+            profiler->ExitStop(cur_child_pid, regs.orig_rax, regs.rax);
+          }
+
+          // Count what the system call wrote under the write limits
+          if (tracee.pending.kind != PtraceSyscall::PendingWrite::NONE) {
+            int fail_errno = group.ptrace_syscall.ProcessSyscallExit(
+                tracee.pending, static_cast<long long>(regs.rax));
+            if (fail_errno != 0) tracee.fail_errno = fail_errno;
+            tracee.pending.kind = PtraceSyscall::PendingWrite::NONE;
+          }
+
+          // Override the return value if the system call has been failed
+          if (tracee.fail_errno != 0) {
+            regs.rax = -tracee.fail_errno;
+            tracee.fail_errno = 0;
+            if (ptrace(PTRACE_SETREGS, cur_child_pid, NULL, &regs) == -1 &&
+                errno != ESRCH) {
+              fail("ptrace PTRACE_SETREGS failed");
+            }
+          }
           continue;
         }
-        // Read register state from the child process
-        struct user_regs_struct regs;
-        REQUIRE(ptrace(PTRACE_GETREGS, cur_child_pid, NULL, &regs) != -1)
-            << "ptrace PTRACE_GETREGS failed: " << strerror(errno);
 
         // Get the system call number
         size_t syscall_num = regs.orig_rax;
@@ -190,57 +894,45 @@ void Trace(pid_t child_pid) {
         std::vector<unsigned long long> args = {regs.rdi, regs.rsi, regs.rdx,
                                                 regs.r10, regs.r8,  regs.r9};
 
-        ptrace_syscalls[ptrace_syscall_lookup_table[cur_child_pid]]
-            .ProcessSyscall(syscall_num, args);
+        if (profiler) profiler->EntryStop(cur_child_pid, syscall_num);
+        if (!check_syscall(cur_child_pid, tracee, syscall_num, args)) {
+          process_quit = true;
+        } else if (group.ptrace_syscall.FailErrno() != 0) {
+          // Skip the system call by replacing it with an invalid one, and
+          // fail it when it returns
+          tracee.fail_errno = group.ptrace_syscall.FailErrno();
+          regs.orig_rax = -1;
+          if (ptrace(PTRACE_SETREGS, cur_child_pid, NULL, &regs) == -1 &&
+              errno != ESRCH) {
+            fail("ptrace PTRACE_SETREGS failed");
+          }
+        } else if (group.ptrace_syscall.RewriteArgs(&args)) {
+          // Run the system call with the arguments it was allowed, e.g. a
+          // write cut short by a write limit
+          regs.rdi = args[RDI];
+          regs.rsi = args[RSI];
+          regs.rdx = args[RDX];
+          regs.r10 = args[R10];
+          regs.r8 = args[R8];
+          regs.r9 = args[R9];
+          if (ptrace(PTRACE_SETREGS, cur_child_pid, NULL, &regs) == -1 &&
+              errno != ESRCH) {
+            fail("ptrace PTRACE_SETREGS failed");
+          }
+        }
+
+        // Other threads of the process may make system calls before this one
+        // returns, so what it may write is kept with the thread
+        if (group.ptrace_syscall.Pending().kind !=
+            PtraceSyscall::PendingWrite::NONE) {
+          tracee.pending = group.ptrace_syscall.Pending();
+        }
       }
     }
   }
-}
-
-int main(int argc, char **argv) {
-  if (argc < 3) {
-    std::cout << "Usage: ./sandbox (config_file) -- program arg1 arg2 ..."
-              << std::endl;
-    exit(1);
-  }
 
-  char **program;
-  if (std::string(argv[1]) == "--") {
-    // Without config file
-    program = &argv[2];
-  } else {
-    // With config file
-    std::string config_file(argv[1]);
-    ParseConfig(config_file);
-    program = &argv[3];
-  }
+  result->stats.bytes_written = write_quota->BytesWritten();
+  result->stats.files_created = write_quota->FilesCreated();
 
-  // Call fork to create a child process
-  pid_t child_pid = fork();
-  REQUIRE(child_pid != -1) << "fork failed: " << strerror(errno);
-
-  // If this is the child, ask to be traced
-  if (child_pid == 0) {
-    REQUIRE(ptrace(PTRACE_TRACEME, 0, NULL, NULL) != -1) << "ptrace failed: "
-                                                         << strerror(errno);
-
-    // Stop the process so the tracer can catch it
-    raise(SIGSTOP);
-
-    REQUIRE(execvp(program[0], program)) << "execvp failed: "
-                                         << strerror(errno);
-  } else {
-    // Wait for the child to stop
-    int status;
-    int result;
-    do {
-      result = waitpid(child_pid, &status, 0);
-      REQUIRE(result == child_pid) << "waitpid failed: " << strerror(errno);
-    } while (!WIFSTOPPED(status));
-
-    Trace(child_pid);
-  }
-
-  return 0;
+  if (profiler) result->profile = profiler->Report();
 }
-
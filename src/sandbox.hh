@@ -0,0 +1,91 @@
+#ifndef SANDBOX_HH
+#define SANDBOX_HH
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "policy.hh"
+#include "syscall_profiler.hh"
+
+// Counters collected while a program runs in the sandbox
+struct SandboxStats {
+  size_t syscalls = 0;        // system calls intercepted
+  size_t forks = 0;           // processes created
+  size_t execs = 0;           // programs executed after the first one
+  size_t peak_processes = 0;  // most processes running at the same time
+  size_t threads = 0;         // threads created in existing processes
+  size_t peak_threads = 0;    // most threads running at the same time
+  size_t stdout_bytes = 0;    // bytes of standard output captured
+  size_t stderr_bytes = 0;    // bytes of standard error captured
+  size_t dropped_bytes = 0;   // bytes of output dropped past the limit
+  size_t bytes_written = 0;   // bytes written under the write limits
+  size_t files_created = 0;   // files created under the write limits
+  double wall_time = 0;       // seconds from start to the last exit
+};
+
+// The outcome of running a program in the sandbox
+struct SandboxResult {
+  bool exited = false;      // the program exited on its own
+  int exit_status = 0;      // exit status of the program, if it exited
+  int term_signal = 0;      // signal that terminated the program, if any
+  std::string violation;    // the restriction the program violated, if any
+  pid_t violating_pid = 0;  // the process that violated the restriction
+  std::string error;        // why the sandbox itself failed, if it did
+  SandboxStats stats;       // counters collected during the run
+  std::vector<SyscallProfile> profile;  // time per system call, if profiled
+};
+
+struct CompiledPolicy;
+class ProcessTree;
+
+// This class runs a program and all its children under a policy. It never
+// exits the calling process: violations and failures are reported in the
+// returned result. Several sandboxes can run at the same time on different
+// threads of one process.
+class Sandbox {
+ public:
+  Sandbox(const Policy& policy);
+
+  // Run the program _argv_[0] with arguments _argv_ until it and all its
+  // children have finished, or until one of them violates the policy, in
+  // which case all of them are killed
+  // The program starts with no signal blocked.
+  SandboxResult Run(const std::vector<std::string>& argv);
+
+  // Replace the policy, including for programs that are already running
+  // The new policy is checked and compiled on the calling thread, which may be
+  // any thread. Each tracee switches to it at its next stop; a stop already
+  // being handled finishes under the old policy. Profiling settings only take
+  // effect on the next Run. A program started without trusted programs has no
+  // seccomp filter, so trusted cannot be set until it finishes. Returns the
+  // first invalid rule, in which case the policy is left unchanged, or an
+  // empty string.
+  std::string UpdatePolicy(const Policy& policy);
+
+ private:
+  // Trace the stopped process _child_pid_ and its children, recording the
+  // outcome in _result_
+  // _loader_files_, if given, may always be read by the program. Once
+  // _output_overflow_, if given, is set, the program is killed. Its processes
+  // are added to _processes_, if given, so another thread can kill them.
+  void Trace(pid_t child_pid,
+             std::shared_ptr<const std::unordered_set<std::string>>
+                 loader_files,
+             const std::atomic<bool>* output_overflow, ProcessTree* processes,
+             SandboxResult* result);
+
+  // The restrictions to enforce. It is only accessed with std::atomic_load and
+  // std::atomic_store, so it can be replaced while a program runs.
+  std::shared_ptr<const CompiledPolicy> policy_;
+
+  std::mutex runs_mutex_;   // orders UpdatePolicy() with starting a program
+  size_t unfiltered_runs_;  // programs running without the seccomp filter
+};
+
+#endif  // SANDBOX_HH
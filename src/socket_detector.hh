@@ -0,0 +1,92 @@
+#ifndef SOCKET_DETECTOR_HH
+#define SOCKET_DETECTOR_HH
+
+#include <sys/socket.h>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+// This class detects if a socket of a given address family and type is allowed
+// by the sandbox
+class SocketDetector {
+ public:
+  // _rules_ is a comma-delimited list of family[/type] rules, e.g.
+  // "unix,inet/stream,inet6/dgram". A rule without a type allows every type of
+  // that family.
+  SocketDetector(std::string rules) {
+    if (rules.empty()) return;
+
+    std::stringstream ss(rules);
+    while (ss.good()) {
+      std::string rule;
+      getline(ss, rule, ',');
+      if (rule.empty()) continue;
+
+      std::string family = rule;
+      std::string type;
+      size_t slash = rule.find('/');
+      if (slash != std::string::npos) {
+        family = rule.substr(0, slash);
+        type = rule.substr(slash + 1);
+      }
+
+      int domain = ParseFamily(family);
+      if (domain == -1) {
+        error_ = "Unknown socket family in rule: " + rule;
+        return;
+      }
+      if (type.empty()) {
+        any_type_families_.insert(domain);
+      } else {
+        int sock_type = ParseType(type);
+        if (sock_type == -1) {
+          error_ = "Unknown socket type in rule: " + rule;
+          return;
+        }
+        family_types_.insert(Key(domain, sock_type));
+      }
+    }
+  }
+
+  // Returns the first invalid rule, or an empty string if all rules are valid
+  const std::string& Error() const { return error_; }
+
+  // Returns true if no rule has been configured
+  bool Empty() const {
+    return any_type_families_.empty() && family_types_.empty();
+  }
+
+  // Decide if socket(_domain_, _type_, ...) is allowed
+  // SOCK_NONBLOCK and SOCK_CLOEXEC flags in _type_ are ignored
+  bool IsAllowed(int domain, int type) const {
+    type &= ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+    return any_type_families_.count(domain) != 0 ||
+           family_types_.count(Key(domain, type)) != 0;
+  }
+
+ private:
+  static int Key(int domain, int type) { return (domain << 16) | type; }
+
+  static int ParseFamily(const std::string& family) {
+    if (family == "unix" || family == "local") return AF_UNIX;
+    if (family == "inet") return AF_INET;
+    if (family == "inet6") return AF_INET6;
+    if (family == "netlink") return AF_NETLINK;
+    if (family == "packet") return AF_PACKET;
+    return -1;
+  }
+
+  static int ParseType(const std::string& type) {
+    if (type == "stream") return SOCK_STREAM;
+    if (type == "dgram") return SOCK_DGRAM;
+    if (type == "seqpacket") return SOCK_SEQPACKET;
+    if (type == "raw") return SOCK_RAW;
+    return -1;
+  }
+
+  std::unordered_set<int> any_type_families_;  // families allowed with any type
+  std::unordered_set<int> family_types_;       // allowed (family, type) pairs
+  std::string error_;                          // the first invalid rule
+};
+
+#endif  // SOCKET_DETECTOR_HH
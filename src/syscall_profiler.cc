@@ -0,0 +1,218 @@
+#include "syscall_profiler.hh"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <time.h>
+#include <algorithm>
+#include <iomanip>
+
+#include "syscall_names.hh"
+
+SyscallProfiler::SyscallProfiler(const std::string &trace_file)
+    : start_ns_(Now()), stop_ns_(start_ns_), trace_(NULL), first_event_(true) {
+  if (trace_file.empty()) return;
+  trace_ = fopen(trace_file.c_str(), "w");
+  if (trace_ == NULL) {
+    error_ = "Cannot open " + trace_file + ": " + strerror(errno);
+    return;
+  }
+  fputs("[\n", trace_);
+}
+
+SyscallProfiler::~SyscallProfiler() {
+  if (trace_ == NULL) return;
+  fputs("\n]\n", trace_);
+  fclose(trace_);
+}
+
+void SyscallProfiler::EntryStop(pid_t pid, long sys_num) {
+  Tracee &tracee = tracees_[pid];
+  if (tracee.tgid == 0) {
+    tracee.tgid = pid;
+
+    // Threads are grouped under their process in the timeline
+    if (trace_ != NULL) {
+      char path[64];
+      snprintf(path, sizeof(path), "/proc/%d/status", pid);
+      FILE *status = fopen(path, "r");
+      if (status != NULL) {
+        char line[256];
+        while (fgets(line, sizeof(line), status) != NULL) {
+          if (strncmp(line, "Tgid:", 5) == 0) {
+            tracee.tgid = atoi(line + 5);
+            break;
+          }
+        }
+        fclose(status);
+      }
+    }
+  }
+  tracee.state = AT_ENTRY;
+  tracee.sys_num = sys_num;
+  tracee.entry_stop = stop_ns_;
+}
+
+void SyscallProfiler::ExitStop(pid_t pid, long sys_num, long ret) {
+  auto it = tracees_.find(pid);
+  if (it == tracees_.end()) return;
+  Tracee &tracee = it->second;
+
+  // An exit without a matching entry (e.g. the first stop of a process) is
+  // not timed
+  if (tracee.state != IN_KERNEL || tracee.sys_num != sys_num) {
+    tracee.state = RUNNING;
+    return;
+  }
+  tracee.state = AT_EXIT;
+  tracee.ret = ret;
+  tracee.exit_stop = stop_ns_;
+}
+
+void SyscallProfiler::Resumed(pid_t pid) {
+  auto it = tracees_.find(pid);
+  if (it == tracees_.end()) return;
+  Tracee &tracee = it->second;
+
+  if (tracee.state == AT_ENTRY) {
+    tracee.entry_resume = Now();
+    tracee.state = IN_KERNEL;
+  } else if (tracee.state == AT_EXIT) {
+    Record(pid, tracee, Now());
+    tracee.state = RUNNING;
+  }
+}
+
+std::vector<SyscallProfile> SyscallProfiler::Report() const {
+  std::vector<SyscallProfile> profile;
+  for (const auto &entry : stats_) {
+    const Stats &stats = entry.second;
+    SyscallProfile syscall;
+    syscall.name = SyscallName(entry.first);
+    syscall.calls = stats.calls;
+    syscall.errors = stats.errors;
+    syscall.total_ns = stats.total_ns;
+    syscall.p50_ns = Percentile(stats, 0.5);
+    syscall.p90_ns = Percentile(stats, 0.9);
+    syscall.p99_ns = Percentile(stats, 0.99);
+    syscall.overhead_ns = stats.overhead_ns;
+    profile.push_back(syscall);
+  }
+  std::sort(profile.begin(), profile.end(),
+            [](const SyscallProfile &a, const SyscallProfile &b) {
+              return a.total_ns > b.total_ns;
+            });
+  return profile;
+}
+
+uint64_t SyscallProfiler::Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int SyscallProfiler::Bucket(uint64_t ns) {
+  if (ns < kSubBuckets) return ns;
+  int msb = 63 - __builtin_clzll(ns);
+  int sub = (ns >> (msb - 3)) & (kSubBuckets - 1);
+  return (msb - 2) * kSubBuckets + sub;
+}
+
+uint64_t SyscallProfiler::BucketTime(int bucket) {
+  if (bucket < kSubBuckets) return bucket;
+  int msb = bucket / kSubBuckets + 2;
+  uint64_t sub = bucket % kSubBuckets;
+  return (kSubBuckets + sub) << (msb - 3);
+}
+
+uint64_t SyscallProfiler::Percentile(const Stats &stats, double fraction) {
+  uint64_t rank = std::max<uint64_t>(1, stats.calls * fraction + 0.5);
+  uint64_t count = 0;
+  for (int bucket = 0; bucket < kBuckets; bucket++) {
+    count += stats.histogram[bucket];
+    if (count >= rank) {
+      // Report the middle of the bucket
+      return (BucketTime(bucket) + BucketTime(bucket + 1)) / 2;
+    }
+  }
+  return 0;
+}
+
+void SyscallProfiler::Record(pid_t pid, const Tracee &tracee,
+                             uint64_t exit_resume) {
+  uint64_t syscall_ns = tracee.exit_stop - tracee.entry_resume;
+  uint64_t overhead_ns = (tracee.entry_resume - tracee.entry_stop) +
+                         (exit_resume - tracee.exit_stop);
+
+  Stats &stats = stats_[tracee.sys_num];
+  stats.calls++;
+  if (tracee.ret < 0 && tracee.ret >= -4095) stats.errors++;
+  stats.total_ns += syscall_ns;
+  stats.overhead_ns += overhead_ns;
+  stats.histogram[Bucket(syscall_ns)]++;
+
+  if (trace_ != NULL) {
+    std::string name = SyscallName(tracee.sys_num) + " + wakeup";
+    WriteEvent("tracer", "tracer", tracee.tgid, pid, tracee.entry_stop,
+               tracee.entry_resume);
+    WriteEvent(name.c_str(), "syscall + wakeup", tracee.tgid, pid, tracee.entry_resume,
+               tracee.exit_stop);
+    WriteEvent("tracer", "tracer", tracee.tgid, pid, tracee.exit_stop,
+               exit_resume);
+  }
+}
+
+void SyscallProfiler::WriteEvent(const char *name, const char *category,
+                                 pid_t pid, pid_t tid, uint64_t start,
+                                 uint64_t end) {
+  fprintf(trace_,
+          "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+          "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+          first_event_ ? "" : ",\n", name, category, pid, tid,
+          (start - start_ns_) / 1e3, (end - start) / 1e3);
+  first_event_ = false;
+}
+
+void PrintProfile(const std::vector<SyscallProfile> &profile,
+                  std::ostream &out) {
+  uint64_t total_ns = 0;
+  uint64_t total_calls = 0;
+  uint64_t total_errors = 0;
+  uint64_t total_overhead_ns = 0;
+  for (const auto &syscall : profile) {
+    total_ns += syscall.total_ns;
+    total_calls += syscall.calls;
+    total_errors += syscall.errors;
+    total_overhead_ns += syscall.overhead_ns;
+  }
+
+  std::ios::fmtflags flags = out.flags();
+  out << "Times are syscall + wakeup, up to the sandbox seeing the exit; "
+      << "tracer s is the time held by the sandbox\n"
+      << std::fixed << "% time     seconds  usecs/call     calls    errors"
+      << "    p50 us    p90 us    p99 us  tracer s syscall\n"
+      << "------ ----------- ----------- --------- --------- --------- "
+      << "--------- --------- --------- ----------------\n";
+  for (const auto &syscall : profile) {
+    out << std::setprecision(2) << std::setw(6)
+        << (total_ns == 0 ? 0 : 100.0 * syscall.total_ns / total_ns) << " "
+        << std::setprecision(6) << std::setw(11) << syscall.total_ns / 1e9
+        << " " << std::setw(11) << syscall.total_ns / 1000 / syscall.calls
+        << " " << std::setw(9) << syscall.calls << " " << std::setw(9)
+        << syscall.errors << std::setprecision(1) << " " << std::setw(9)
+        << syscall.p50_ns / 1e3 << " " << std::setw(9) << syscall.p90_ns / 1e3
+        << " " << std::setw(9) << syscall.p99_ns / 1e3 << std::setprecision(6)
+        << " " << std::setw(9) << syscall.overhead_ns / 1e9 << " "
+        << syscall.name << "\n";
+  }
+  out << "------ ----------- ----------- --------- --------- --------- "
+      << "--------- --------- --------- ----------------\n"
+      << std::setprecision(2) << std::setw(6) << 100.0 << " "
+      << std::setprecision(6) << std::setw(11) << total_ns / 1e9 << " "
+      << std::setw(11) << (total_calls == 0 ? 0 : total_ns / 1000 / total_calls)
+      << " " << std::setw(9) << total_calls << " " << std::setw(9)
+      << total_errors << " " << std::setw(9) << "" << " " << std::setw(9) << ""
+      << " " << std::setw(9) << "" << " " << std::setw(9)
+      << total_overhead_ns / 1e9 << " total\n";
+  out.flags(flags);
+}
@@ -0,0 +1,119 @@
+#ifndef SYSCALL_PROFILER_HH
+#define SYSCALL_PROFILER_HH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Time spent in one system call, summed over all its calls
+struct SyscallProfile {
+  std::string name;          // name of the system call
+  uint64_t calls = 0;        // number of calls
+  uint64_t errors = 0;       // number of calls that returned an error
+  uint64_t total_ns = 0;     // time spent in the call and the wakeup
+  uint64_t p50_ns = 0;       // median time of one call and its wakeup
+  uint64_t p90_ns = 0;       // 90th percentile time of a call and its wakeup
+  uint64_t p99_ns = 0;       // 99th percentile time of a call and its wakeup
+  uint64_t overhead_ns = 0;  // time the tracee was held by the tracer
+};
+
+// This class times every system call a tracee makes. The tracer marks when a
+// tracee stops at the entry and exit of a system call, and when it resumes the
+// tracee. The time from resuming at the entry to stopping at the exit is spent
+// in the system call and in waking up the tracer at the exit, which cannot be
+// told apart, while the time from each stop to the next resume is added by
+// the tracer.
+class SyscallProfiler {
+ public:
+  // Per-process timelines are written to _trace_file_ in Chrome trace event
+  // format, unless it is empty
+  SyscallProfiler(const std::string& trace_file);
+  ~SyscallProfiler();
+
+  // Returns why the trace file could not be written, or an empty string
+  const std::string& Error() const { return error_; }
+
+  // Mark that a tracee has just stopped
+  void MarkStop() { stop_ns_ = Now(); }
+
+  // Mark that tracee _pid_ stopped at the entry of system call _sys_num_
+  void EntryStop(pid_t pid, long sys_num);
+
+  // Mark that tracee _pid_ stopped at the exit of system call _sys_num_, which
+  // returned _ret_
+  void ExitStop(pid_t pid, long sys_num, long ret);
+
+  // Mark that tracee _pid_ has just been resumed
+  void Resumed(pid_t pid);
+
+  // Forget tracee _pid_ once it has exited
+  void Exited(pid_t pid) { tracees_.erase(pid); }
+
+  // Returns the profile of every system call made so far, most expensive first
+  std::vector<SyscallProfile> Report() const;
+
+ private:
+  // Times are kept in a histogram with 8 buckets per power of two, so
+  // percentiles are within 1/8 of the true value
+  static const int kSubBuckets = 8;
+  static const int kBuckets = 64 * kSubBuckets;
+
+  // Where a tracee is in its current system call
+  enum State { RUNNING, AT_ENTRY, IN_KERNEL, AT_EXIT };
+
+  // Timestamps of the current system call of a tracee
+  struct Tracee {
+    State state = RUNNING;      // where the tracee is
+    long sys_num = -1;          // the current system call
+    long ret = 0;               // its return value
+    pid_t tgid = 0;             // the thread group of the tracee
+    uint64_t entry_stop = 0;    // when the tracee stopped at the entry
+    uint64_t entry_resume = 0;  // when the tracee was resumed at the entry
+    uint64_t exit_stop = 0;     // when the tracee stopped at the exit
+  };
+
+  // Totals of one system call
+  struct Stats {
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    uint64_t total_ns = 0;
+    uint64_t overhead_ns = 0;
+    std::vector<uint32_t> histogram = std::vector<uint32_t>(kBuckets, 0);
+  };
+
+  // Returns the monotonic time in nanoseconds
+  static uint64_t Now();
+
+  // Returns the histogram bucket of _ns_ and the smallest time in a bucket
+  static int Bucket(uint64_t ns);
+  static uint64_t BucketTime(int bucket);
+
+  // Returns the _fraction_ percentile of _stats_
+  static uint64_t Percentile(const Stats& stats, double fraction);
+
+  // Record a finished system call of _tracee_ resumed at _exit_resume_
+  void Record(pid_t pid, const Tracee& tracee, uint64_t exit_resume);
+
+  // Write a complete event to the trace file
+  void WriteEvent(const char* name, const char* category, pid_t pid,
+                  pid_t tid, uint64_t start, uint64_t end);
+
+  uint64_t start_ns_;  // when profiling started
+  uint64_t stop_ns_;   // when the current stop was seen
+  FILE* trace_;        // the Chrome trace file, if any
+  bool first_event_;   // no event has been written to the trace file yet
+  std::string error_;  // why the trace file could not be written
+  std::unordered_map<pid_t, Tracee> tracees_;  // tracees by pid
+  std::map<long, Stats> stats_;                // totals by system call number
+};
+
+// Print _profile_ as a table in the style of strace -c
+void PrintProfile(const std::vector<SyscallProfile>& profile,
+                  std::ostream& out);
+
+#endif  // SYSCALL_PROFILER_HH
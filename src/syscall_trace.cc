@@ -0,0 +1,141 @@
+#include "syscall_trace.hh"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+
+#define TRACE_HEADER "# g-sandbox syscall trace 3"
+
+// The line before the directory relative file names were resolved against
+#define TRACE_CWD "# cwd "
+
+// The header of traces written before the tgid was recorded
+#define TRACE_HEADER_V1 "# g-sandbox syscall trace 1"
+
+// Returns _data_ in hexadecimal, or "-" if it is empty
+static std::string HexEncode(const std::string &data) {
+  static const char kDigits[] = "0123456789abcdef";
+  if (data.empty()) return "-";
+  std::string hex;
+  hex.reserve(data.size() * 2);
+  for (unsigned char c : data) {
+    hex.push_back(kDigits[c >> 4]);
+    hex.push_back(kDigits[c & 0xf]);
+  }
+  return hex;
+}
+
+// Decode _hex_ as written by HexEncode into _data_
+// Returns false if it is malformed.
+static bool HexDecode(const std::string &hex, std::string *data) {
+  data->clear();
+  if (hex == "-") return true;
+  if (hex.size() % 2 != 0) return false;
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    int value = 0;
+    for (size_t j = i; j < i + 2; j++) {
+      char c = hex[j];
+      if (c >= '0' && c <= '9') {
+        value = value * 16 + c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        value = value * 16 + c - 'a' + 10;
+      } else {
+        return false;
+      }
+    }
+    data->push_back(static_cast<char>(value));
+  }
+  return true;
+}
+
+SyscallRecorder::SyscallRecorder(const std::string &record_file) {
+  file_ = fopen(record_file.c_str(), "w");
+  if (file_ == NULL) {
+    error_ = "Cannot open " + record_file + ": " + strerror(errno);
+    return;
+  }
+  fprintf(file_, "%s\n", TRACE_HEADER);
+
+  // The sandbox resolves relative file names against the directory it runs
+  // in, which is where the program starts
+  char *cwd = realpath(".", NULL);
+  if (cwd == NULL) {
+    error_ = std::string("realpath() failed: ") + strerror(errno);
+    return;
+  }
+  fprintf(file_, "%s%s\n", TRACE_CWD, cwd);
+  free(cwd);
+}
+
+SyscallRecorder::~SyscallRecorder() {
+  if (file_ != NULL) fclose(file_);
+}
+
+void SyscallRecorder::Record(pid_t pid, pid_t tgid, long sys_num,
+                             const std::vector<unsigned long long> &args) {
+  if (file_ != NULL) {
+    fprintf(file_, "%d %d %ld", pid, tgid, sys_num);
+    for (unsigned long long arg : args) fprintf(file_, " %llx", arg);
+    fprintf(file_, " %zu", peeks_.size());
+    for (const TracePeek &peek : peeks_) {
+      fprintf(file_, " %" PRIx64 " %" PRId64 " %s", peek.addr, peek.len,
+              HexEncode(peek.data).c_str());
+    }
+    fprintf(file_, "\n");
+  }
+  peeks_.clear();
+}
+
+bool ReadTrace(const std::string &trace_file,
+               std::vector<TraceRecord> *records, std::string *cwd,
+               std::string *error) {
+  std::ifstream in(trace_file);
+  if (!in) {
+    *error = "Cannot open " + trace_file + ": " + strerror(errno);
+    return false;
+  }
+
+  std::string line;
+  size_t line_num = 0;
+  bool has_tgid = true;
+  cwd->clear();
+  while (getline(in, line)) {
+    line_num++;
+    if (line == TRACE_HEADER_V1) has_tgid = false;
+    if (line.compare(0, strlen(TRACE_CWD), TRACE_CWD) == 0) {
+      *cwd = line.substr(strlen(TRACE_CWD));
+    }
+    if (line.empty() || line[0] == '#') continue;
+
+    std::istringstream ss(line);
+    TraceRecord record;
+    size_t num_peeks;
+    record.args.resize(6);
+    ss >> record.pid;
+    if (has_tgid) {
+      ss >> record.tgid;
+    } else {
+      record.tgid = record.pid;
+    }
+    ss >> record.sys_num;
+    for (unsigned long long &arg : record.args) ss >> std::hex >> arg;
+    ss >> std::dec >> num_peeks;
+    for (size_t i = 0; ss && i < num_peeks; i++) {
+      TracePeek peek;
+      std::string hex;
+      ss >> std::hex >> peek.addr >> std::dec >> peek.len >> hex;
+      if (!HexDecode(hex, &peek.data)) ss.setstate(std::ios::failbit);
+      record.peeks.push_back(peek);
+    }
+    if (!ss) {
+      *error = trace_file + ":" + std::to_string(line_num) +
+               ": malformed system call record";
+      return false;
+    }
+    records->push_back(record);
+  }
+  return true;
+}
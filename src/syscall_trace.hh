@@ -0,0 +1,117 @@
+#ifndef SYSCALL_TRACE_HH
+#define SYSCALL_TRACE_HH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include "memory_reader.hh"
+#include "ptrace_peek.hh"
+
+// A read of tracee memory made while a system call was checked
+struct TracePeek {
+  uint64_t addr;     // address read
+  int64_t len;       // bytes read, or -1 for a null-terminated string
+  std::string data;  // what was read
+};
+
+// A system call as it was checked against the policy
+struct TraceRecord {
+  pid_t pid;                               // the calling thread
+  pid_t tgid;                              // the process it belongs to
+  long sys_num;                            // the system call number
+  std::vector<unsigned long long> args;    // its six arguments
+  std::vector<TracePeek> peeks;            // the memory read to check it
+};
+
+// A memory reader that reads a tracee's memory and keeps every read in _peeks_
+class RecordingPeek : public MemoryReader {
+ public:
+  RecordingPeek(pid_t child_pid, std::vector<TracePeek>* peeks)
+      : ptrace_peek_(child_pid), peeks_(peeks) {}
+
+  std::string operator[](void* addr) const override {
+    std::string str = ptrace_peek_[addr];
+    peeks_->push_back({reinterpret_cast<uint64_t>(addr), -1, str});
+    return str;
+  }
+
+  std::string Read(void* addr, size_t len) const override {
+    std::string bytes = ptrace_peek_.Read(addr, len);
+    peeks_->push_back({reinterpret_cast<uint64_t>(addr),
+                       static_cast<int64_t>(len), bytes});
+    return bytes;
+  }
+
+ private:
+  PtracePeek ptrace_peek_;          // reads the tracee's memory
+  std::vector<TracePeek>* peeks_;   // where reads are kept
+};
+
+// A memory reader that answers reads from the peeks of a recorded system call
+// Memory that was not read when the call was recorded reads as empty.
+class ReplayPeek : public MemoryReader {
+ public:
+  // Answer reads from _record_ until the next call
+  void Load(const TraceRecord* record) { record_ = record; }
+
+  std::string operator[](void* addr) const override {
+    return Find(reinterpret_cast<uint64_t>(addr), -1);
+  }
+
+  std::string Read(void* addr, size_t len) const override {
+    return Find(reinterpret_cast<uint64_t>(addr), static_cast<int64_t>(len));
+  }
+
+ private:
+  std::string Find(uint64_t addr, int64_t len) const {
+    if (record_ == NULL) return "";
+    for (const TracePeek& peek : record_->peeks) {
+      if (peek.addr == addr && peek.len == len) return peek.data;
+    }
+    return "";
+  }
+
+  const TraceRecord* record_ = NULL;  // the system call being replayed
+};
+
+// This class writes every checked system call to a trace file, one line each:
+//   pid tgid sys_num arg0 ... arg5 peeks [addr len data]...
+// after a header naming the directory relative file names are resolved
+// against.
+// Numbers are hexadecimal, except pid, tgid, sys_num and len (-1 for a
+// string), and data is hex-encoded ("-" if empty).
+class SyscallRecorder {
+ public:
+  SyscallRecorder(const std::string& record_file);
+  ~SyscallRecorder();
+
+  // Returns why the trace file could not be written, or an empty string
+  const std::string& Error() const { return error_; }
+
+  // Returns where the memory reads of the current system call are kept
+  std::vector<TracePeek>* peeks() { return &peeks_; }
+
+  // Write system call _sys_num_ with arguments _args_ made by thread _pid_ of
+  // process _tgid_, along with the memory read to check it
+  void Record(pid_t pid, pid_t tgid, long sys_num,
+              const std::vector<unsigned long long>& args);
+
+ private:
+  FILE* file_ = NULL;               // the trace file
+  std::vector<TracePeek> peeks_;    // memory reads of the current system call
+  std::string error_;               // why the trace file cannot be written
+};
+
+// Read the system calls recorded in _trace_file_ into _records_, and the
+// directory their relative file names were resolved against into _cwd_
+// Traces of the first version have no tgid, so every thread is taken to be a
+// process of its own, and traces before the third have no directory, so
+// _cwd_ is left empty. Returns false and stores the reason in _error_ if the
+// file cannot be read or parsed.
+bool ReadTrace(const std::string& trace_file, std::vector<TraceRecord>* records,
+               std::string* cwd, std::string* error);
+
+#endif  // SYSCALL_TRACE_HH
@@ -0,0 +1,51 @@
+#include "trusted_filter.hh"
+
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include "ptrace_syscall.hh"
+
+// The system calls checked for trusted programs: sending signals to other
+// processes and using the network. System calls unknown to the sandbox are
+// stopped too, so they fail.
+static const unsigned int kCheckedSyscalls[] = {
+    SYS_kill,   SYS_tkill,      SYS_tgkill,  SYS_rt_sigqueueinfo,
+    SYS_rt_tgsigqueueinfo,
+    SYS_socket, SYS_socketpair, SYS_connect, SYS_bind,
+    SYS_sendto, SYS_sendmsg,    SYS_sendmmsg};
+
+std::vector<struct sock_filter> TrustedFilter() {
+  std::vector<struct sock_filter> filter = {
+      // System calls of another architecture or of the x32 ABI have other
+      // numbers, so they are all stopped
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | TRUSTED_FILTER_FOREIGN),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+      BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, __X32_SYSCALL_BIT, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | TRUSTED_FILTER_FOREIGN),
+      BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, NUM_KNOWN_SYSCALLS, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | TRUSTED_FILTER_NATIVE),
+  };
+  for (unsigned int syscall_num : kCheckedSyscalls) {
+    filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, syscall_num, 0, 1));
+    filter.push_back(
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | TRUSTED_FILTER_NATIVE));
+  }
+  filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+  return filter;
+}
+
+bool InstallFilter(std::vector<struct sock_filter> *filter) {
+  struct sock_fprog program;
+  program.len = filter->size();
+  program.filter = filter->data();
+
+  // Without privileges, a filter may only be installed by a process that
+  // cannot gain any, e.g. by executing a set-user-ID program
+  return prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 &&
+         prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) == 0;
+}
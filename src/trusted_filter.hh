@@ -0,0 +1,22 @@
+#ifndef TRUSTED_FILTER_HH
+#define TRUSTED_FILTER_HH
+
+#include <linux/filter.h>
+#include <vector>
+
+// The data a filtered system call reports with PTRACE_EVENT_SECCOMP
+#define TRUSTED_FILTER_NATIVE 1   // a system call checked by the sandbox
+#define TRUSTED_FILTER_FOREIGN 2  // a system call of another architecture
+
+// Returns a seccomp filter that stops the few system calls a trusted program
+// is still checked for at the sandbox, and lets every other one run without
+// stopping. The stops are reported as PTRACE_EVENT_SECCOMP.
+std::vector<struct sock_filter> TrustedFilter();
+
+// Install _filter_ in the calling process, so it applies to the program the
+// process executes next and to all its children
+// Only async-signal-safe functions are called, so a child of a multithreaded
+// process may call it. Returns false if the filter cannot be installed.
+bool InstallFilter(std::vector<struct sock_filter>* filter);
+
+#endif  // TRUSTED_FILTER_HH
@@ -0,0 +1,148 @@
+#ifndef WRITE_QUOTA_HH
+#define WRITE_QUOTA_HH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include "policy.hh"
+
+// This class keeps the bytes written and the files created under each
+// read_write directory by a program and all its children, against the limits
+// of a policy on each directory and on all of them together. Every decision
+// takes constant time.
+class WriteQuota {
+ public:
+  // What to do with a system call that exceeds a limit
+  enum Action {
+    KILL,  // kill the program
+    FAIL   // make the system call fail with EDQUOT and let the program go on
+  };
+
+  // Limits are taken from _policy_. A limit of 0 means unlimited.
+  WriteQuota(const Policy& policy)
+      : max_bytes_(policy.write_limit > 0 ? policy.write_limit : 0),
+        max_files_(policy.create_limit > 0 ? policy.create_limit : 0),
+        max_total_bytes_(
+            policy.total_write_limit > 0 ? policy.total_write_limit : 0),
+        max_total_files_(
+            policy.total_create_limit > 0 ? policy.total_create_limit : 0),
+        action_(ParseAction(policy.write_limit_action)) {}
+
+  // Enforce the limits of _policy_ from now on. What has been written so far
+  // is kept.
+  void Update(const Policy& policy) {
+    WriteQuota quota(policy);
+    quota.usage_.swap(usage_);
+    quota.total_bytes_ = total_bytes_;
+    quota.total_files_ = total_files_;
+    *this = quota;
+  }
+
+  // Returns the invalid action, or an empty string if the action is valid
+  const std::string& Error() const { return error_; }
+
+  // Returns true if there is any limit to enforce
+  bool Enabled() const {
+    return max_bytes_ != 0 || max_files_ != 0 || max_total_bytes_ != 0 ||
+           max_total_files_ != 0;
+  }
+
+  // Returns what to do with a system call that exceeds a limit
+  Action action() const { return action_; }
+
+  // Decide if _bytes_ more bytes may be written under the directory _root_
+  // Returns an empty string if so, otherwise the violated limit.
+  std::string AdmitWrite(const std::string& root, size_t bytes) const {
+    if (bytes > Left(max_total_bytes_, total_bytes_)) {
+      return "total_write_limit";
+    }
+    auto it = usage_.find(root);
+    size_t written = it != usage_.end() ? it->second.bytes : 0;
+    return bytes > Left(max_bytes_, written) ? "write_limit" : "";
+  }
+
+  // Returns how many more bytes may be written under the directory _root_
+  size_t Remaining(const std::string& root) const {
+    auto it = usage_.find(root);
+    size_t written = it != usage_.end() ? it->second.bytes : 0;
+    return std::min(Left(max_bytes_, written),
+                    Left(max_total_bytes_, total_bytes_));
+  }
+
+  // Decide if one more file may be created under the directory _root_
+  // Returns an empty string if so, otherwise the violated limit.
+  std::string AdmitCreate(const std::string& root) const {
+    if (Left(max_total_files_, total_files_) == 0) return "total_create_limit";
+    auto it = usage_.find(root);
+    size_t created = it != usage_.end() ? it->second.files : 0;
+    return Left(max_files_, created) == 0 ? "create_limit" : "";
+  }
+
+  // Record that _bytes_ bytes are written under _root_
+  // They are counted when the write is admitted, so writes made at the same
+  // time by several threads cannot go past the limit together.
+  void Wrote(const std::string& root, size_t bytes) {
+    usage_[root].bytes += bytes;
+    total_bytes_ += bytes;
+  }
+
+  // Record that a file is created under _root_
+  void Created(const std::string& root) {
+    usage_[root].files++;
+    total_files_++;
+  }
+
+  // Give back _bytes_ bytes and _files_ files recorded under _root_ for a
+  // system call that wrote or created less
+  void Returned(const std::string& root, size_t bytes, size_t files) {
+    Usage& usage = usage_[root];
+    usage.bytes -= bytes;
+    usage.files -= files;
+    total_bytes_ -= bytes;
+    total_files_ -= files;
+  }
+
+  // Returns the number of bytes written under every directory so far
+  size_t BytesWritten() const { return total_bytes_; }
+
+  // Returns the number of files created under every directory so far
+  size_t FilesCreated() const { return total_files_; }
+
+ private:
+  // What has been written under one directory
+  struct Usage {
+    size_t bytes = 0;  // bytes written
+    size_t files = 0;  // files created
+  };
+
+  // Returns what is left of _limit_ once _used_ is taken, SIZE_MAX if there
+  // is no limit
+  static size_t Left(size_t limit, size_t used) {
+    if (limit == 0) return SIZE_MAX;
+    return used < limit ? limit - used : 0;
+  }
+
+  Action ParseAction(const std::string& action) {
+    if (action == "fail") return FAIL;
+    if (action != "kill" && !action.empty()) {
+      error_ = "Unknown write limit action: " + action;
+    }
+    return KILL;
+  }
+
+  std::string error_;       // the invalid action
+  size_t max_bytes_;        // maximum bytes written under each directory
+  size_t max_files_;        // maximum files created under each directory
+  size_t max_total_bytes_;  // maximum bytes written under every directory
+  size_t max_total_files_;  // maximum files created under every directory
+  Action action_;           // action when a limit is exceeded
+  size_t total_bytes_ = 0;  // bytes written under every directory
+  size_t total_files_ = 0;  // files created under every directory
+  std::unordered_map<std::string, Usage>
+      usage_;  // what has been written, by read_write directory
+};
+
+#endif  // WRITE_QUOTA_HH
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sandbox.hh"
+
+// Number of sandboxes running at the same time
+#define NUM_SANDBOXES 4
+
+int main() {
+  // Every sandbox runs fork_test, which needs to fork and read /proc
+  Policy policy;
+  policy.read_file = "/";
+  policy.forkable = true;
+
+  // The last sandbox is not allowed to fork
+  Policy no_fork_policy = policy;
+  no_fork_policy.forkable = false;
+
+  std::vector<SandboxResult> results(NUM_SANDBOXES + 1);
+  std::vector<std::thread> threads;
+  for (int i = 0; i <= NUM_SANDBOXES; i++) {
+    threads.emplace_back([&, i] {
+      Sandbox sandbox(i < NUM_SANDBOXES ? policy : no_fork_policy);
+      results[i] = sandbox.Run({"./fork_test", "1000"});
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  int failed = 0;
+  for (int i = 0; i <= NUM_SANDBOXES; i++) {
+    const SandboxResult& result = results[i];
+    printf("sandbox %d: %s %d, %zu forks, violation \"%s\", error \"%s\"\n", i,
+           result.exited ? "exit status" : "signal",
+           result.exited ? result.exit_status : result.term_signal,
+           result.stats.forks, result.violation.c_str(), result.error.c_str());
+
+    bool expected = i < NUM_SANDBOXES
+                        ? result.exited && result.exit_status == 0 &&
+                              result.stats.forks == 1000
+                        : !result.violation.empty();
+    if (!expected || !result.error.empty()) failed++;
+  }
+
+  // The host process is still alive after a violation
+  if (failed != 0) {
+    printf("FAIL: %d sandboxes had an unexpected result\n", failed);
+    exit(1);
+  }
+  printf("Finished the program\n");
+}
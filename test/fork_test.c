@@ -0,0 +1,97 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Number of forks measured together
+#define BATCH_SIZE 1000
+
+// Returns the monotonic time in microseconds
+static double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Returns the resident set size of process _pid_ in kB, or -1 if unknown
+static long rss_kb(pid_t pid) {
+  char path[64];
+  char buf[4096];
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+
+  // Call open directly so the sandbox sees open rather than openat
+  int fd = syscall(SYS_open, path, O_RDONLY, 0);
+  if (fd == -1) return -1;
+  ssize_t len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (len <= 0) return -1;
+  buf[len] = '\0';
+
+  char* line = strstr(buf, "VmRSS:");
+  return line == NULL ? -1 : atol(line + strlen("VmRSS:"));
+}
+
+int main(int argc, char** argv) {
+  int total = argc > 1 ? atoi(argv[1]) : 10000;
+
+  // The sandbox is the parent of the traced program
+  pid_t tracer = getppid();
+
+  double first_latency = 0;
+  double last_latency = 0;
+  long first_rss = -1;
+  long last_rss = -1;
+  int failed = 0;
+
+  for (int batch = 0; batch * BATCH_SIZE < total; batch++) {
+    double start = now_us();
+    int forks = 0;
+    for (int i = 0; i < BATCH_SIZE && batch * BATCH_SIZE + i < total; i++) {
+      pid_t child_pid = fork();
+      if (child_pid == -1) {
+        if (errno != EAGAIN) {
+          perror("fork");
+          exit(2);
+        }
+        failed++;
+      } else if (child_pid == 0) {
+        _exit(0);
+      } else {
+        waitpid(child_pid, NULL, 0);
+      }
+      forks++;
+    }
+    double latency = (now_us() - start) / forks;
+    long rss = rss_kb(tracer);
+    printf("forks %6d-%6d: %8.1f us per fork, tracer rss %ld kB\n",
+           batch * BATCH_SIZE, batch * BATCH_SIZE + forks, latency, rss);
+
+    if (batch == 0) {
+      first_latency = latency;
+      first_rss = rss;
+    }
+    last_latency = latency;
+    last_rss = rss;
+  }
+  printf("%d of %d forks failed with EAGAIN\n", failed, total);
+
+  // Tracer memory and per-fork latency should not grow with the number of
+  // processes created so far
+  if (first_rss != -1 && last_rss > first_rss + 1024) {
+    printf("FAIL: tracer memory grew from %ld kB to %ld kB\n", first_rss,
+           last_rss);
+    exit(1);
+  }
+  if (last_latency > first_latency * 3) {
+    printf("FAIL: fork latency grew from %.1f us to %.1f us\n", first_latency,
+           last_latency);
+    exit(1);
+  }
+  printf("Finished the program\n");
+}
@@ -0,0 +1,82 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Number of datagrams sent to the same loopback destination
+#define NUM_DATAGRAMS 1000
+
+int main() {
+  // A unix socket pair
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+    perror("socketpair");
+    exit(2);
+  }
+  printf("Created unix socket pair\n");
+
+  // A TCP server and client on the loopback interface
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+
+  int server = socket(AF_INET, SOCK_STREAM, 0);
+  if (server == -1 || bind(server, (struct sockaddr*)&addr, addr_len) == -1 ||
+      listen(server, 1) == -1 ||
+      getsockname(server, (struct sockaddr*)&addr, &addr_len) == -1) {
+    perror("loopback server");
+    exit(2);
+  }
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  if (client == -1 || connect(client, (struct sockaddr*)&addr, addr_len)) {
+    perror("loopback connect");
+    exit(2);
+  }
+  int conn = accept(server, NULL, NULL);
+  char buf[16];
+  if (conn == -1 || write(client, "ping", 4) != 4 || read(conn, buf, 4) != 4) {
+    perror("loopback tcp");
+    exit(2);
+  }
+  printf("Connected to loopback TCP server on port %d\n", ntohs(addr.sin_port));
+
+  // A UDP socket sending datagrams to itself
+  int udp = socket(AF_INET, SOCK_DGRAM, 0);
+  addr.sin_port = 0;
+  addr_len = sizeof(addr);
+  if (udp == -1 || bind(udp, (struct sockaddr*)&addr, addr_len) == -1 ||
+      getsockname(udp, (struct sockaddr*)&addr, &addr_len) == -1) {
+    perror("loopback udp");
+    exit(2);
+  }
+  for (int i = 0; i < NUM_DATAGRAMS; i++) {
+    if (sendto(udp, "x", 1, 0, (struct sockaddr*)&addr, addr_len) != 1 ||
+        recv(udp, buf, sizeof(buf), 0) != 1) {
+      perror("sendto");
+      exit(2);
+    }
+  }
+  printf("Sent %d datagrams to loopback UDP port %d\n", NUM_DATAGRAMS,
+         ntohs(addr.sin_port));
+
+  // A destination outside the loopback network (TEST-NET-1)
+  struct sockaddr_in remote;
+  memset(&remote, 0, sizeof(remote));
+  remote.sin_family = AF_INET;
+  remote.sin_port = htons(80);
+  inet_pton(AF_INET, "192.0.2.1", &remote.sin_addr);
+  int outside = socket(AF_INET, SOCK_STREAM, 0);
+  fcntl(outside, F_SETFL, O_NONBLOCK);
+  connect(outside, (struct sockaddr*)&remote, sizeof(remote));
+  printf("Connected to a non-loopback address\n");
+
+  printf("Finished the program\n");
+}
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char** argv) {
+  long total = argc > 1 ? atol(argv[1]) : 100000000;
+
+  // Write _total_ bytes to stdout in 64KB chunks, more than a pipe holds, so
+  // the sandbox has to keep moving the output while the program runs
+  static char buf[1 << 16];
+  memset(buf, 'x', sizeof(buf));
+  for (long written = 0; written < total; written += sizeof(buf)) {
+    if (write(STDOUT_FILENO, buf, sizeof(buf)) == -1) {
+      perror("write failed");
+      exit(2);
+    }
+  }
+  fprintf(stderr, "Finished the program\n");
+}
@@ -0,0 +1,24 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int main(int argc, char** argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 10;
+
+  // Create a socket every second, so a reloaded policy that forbids sockets
+  // stops the program at its next attempt
+  for (int i = 0; i < seconds; i++) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == -1) {
+      perror("socket failed");
+      exit(2);
+    }
+    close(s);
+    printf("Created socket %d\n", i);
+    fflush(stdout);
+    sleep(1);
+  }
+
+  printf("Finished the program\n");
+}
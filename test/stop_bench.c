@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Returns the monotonic time in nanoseconds
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+  int total = argc > 1 ? atoi(argv[1]) : 100000;
+
+  // getppid is about the cheapest system call, so the time measured is
+  // dominated by the two stops (entry and exit) in the sandbox
+  double start = now_ns();
+  for (int i = 0; i < total; i++) {
+    syscall(SYS_getppid);
+  }
+  double per_syscall = (now_ns() - start) / total;
+
+  printf("%d syscalls: %.0f ns per syscall, %.0f ns per stop\n", total,
+         per_syscall, per_syscall / 2);
+  printf("Finished the program\n");
+}
@@ -0,0 +1,52 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static int calls_per_thread;
+static pthread_barrier_t barrier;
+
+// Returns the monotonic time in nanoseconds
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void* run(void* arg) {
+  // Start every thread at once, so the sandbox sees all of them stopping
+  pthread_barrier_wait(&barrier);
+  for (int i = 0; i < calls_per_thread; i++) {
+    syscall(SYS_getppid);
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int num_threads = argc > 1 ? atoi(argv[1]) : 256;
+  calls_per_thread = argc > 2 ? atoi(argv[2]) : 1000;
+
+  pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+  pthread_barrier_init(&barrier, NULL, num_threads + 1);
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, run, NULL) != 0) {
+      perror("pthread_create failed");
+      exit(2);
+    }
+  }
+
+  // Each getppid call stops twice in the sandbox (entry and exit)
+  double start = now_ns();
+  pthread_barrier_wait(&barrier);
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = now_ns() - start;
+  long stops = 2L * num_threads * calls_per_thread;
+
+  printf("%d threads, %ld stops: %.0f stops per second, %.0f ns per stop\n",
+         num_threads, stops, stops / elapsed * 1e9, elapsed / stops);
+  printf("Finished the program\n");
+}
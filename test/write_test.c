@@ -0,0 +1,57 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+int main(int argc, char** argv) {
+  int files = argc > 1 ? atoi(argv[1]) : 100;
+  long file_size = argc > 2 ? atol(argv[2]) : 1 << 20;
+
+  // Behave like a runaway job: keep creating files in /tmp/write_test/ and
+  // filling them, through write(), writev() and a duplicated fd, until the
+  // sandbox makes a call fail
+  if (mkdir("/tmp/write_test/", 0755) == -1 && errno != EEXIST) {
+    perror("mkdir failed");
+    exit(2);
+  }
+  static char buf[1 << 16];
+  memset(buf, 'x', sizeof(buf));
+  long total = 0;
+  for (int i = 0; i < files; i++) {
+    char name[64];
+    snprintf(name, sizeof(name), "/tmp/write_test/file%d", i);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+      printf("Cannot create file %d: %s\n", i, strerror(errno));
+      break;
+    }
+    int dup_fd = dup(fd);
+    for (long written = 0; written < file_size; written += sizeof(buf)) {
+      struct iovec iov[2] = {{buf, sizeof(buf) / 2}, {buf, sizeof(buf) / 2}};
+      ssize_t ret;
+      switch (written / sizeof(buf) % 3) {
+        case 0:
+          ret = write(fd, buf, sizeof(buf));
+          break;
+        case 1:
+          ret = writev(fd, iov, 2);
+          break;
+        default:
+          ret = write(dup_fd, buf, sizeof(buf));
+      }
+      if (ret == -1) {
+        printf("Cannot write file %d: %s\n", i, strerror(errno));
+        printf("Wrote %ld bytes\n", total);
+        exit(1);
+      }
+      total += ret;
+    }
+    close(dup_fd);
+    close(fd);
+  }
+  printf("Wrote %ld bytes\n", total);
+}